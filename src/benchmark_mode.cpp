@@ -0,0 +1,301 @@
+#ifdef MODE_BENCHMARK
+#include "benchmark_mode.h"
+#include "bus_command.h"
+#include "bus_settings.h"
+#include "packet_pool.h"
+#include "settings_store.h"
+#include "spsc_ring.h"
+#include <LittleFS.h>
+#ifdef CONFIG_SPI_FLASH_ENABLE_COUNTERS
+#include <esp_spi_flash_counters.h>
+#endif
+
+// Compares the lock-free SpscRing/PacketPool handoff against FreeRTOS queues (and the packet pool against
+// new/delete), both within one task and between two tasks. Between tasks, the consumer is woken by a task
+// notification in the ring case, which is how a bus worker would use it. On dual-core chips the consumer
+// runs on the other core from loop().
+//
+// The settings storage benchmarks save and load a bus settings record through each SettingsStore backend.
+// Bytes written per save come from the SPI flash counters when the framework has
+// CONFIG_SPI_FLASH_ENABLE_COUNTERS; otherwise only the record size is known.
+
+#define BENCHMARK_ITERATIONS 20000
+#define BENCHMARK_DEPTH 16          // Ring/queue/pool depth (same as a bus's command queue, rounded up)
+#define BENCHMARK_STACK_SIZE 4096
+#define BENCHMARK_STORAGE_SAVES 50
+#define BENCHMARK_STORAGE_KEY "bench_settings"
+
+static SpscRing<BusCommand, BENCHMARK_DEPTH> command_ring;
+static SpscRing<PooledPacket*, BENCHMARK_DEPTH> packet_ring;
+static PacketPool<BENCHMARK_DEPTH> packet_pool;
+static QueueHandle_t command_queue;
+static QueueHandle_t packet_queue;  // PooledPacket by value
+
+static TaskHandle_t producer_task;
+static TaskHandle_t consumer_task;
+static volatile uint32_t checksum;  // Keeps the compiler from dropping the work
+
+static const uint8_t sample_frame[11] = {0xAA, 0x01, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xAE};
+
+static void report(const char* name, int64_t elapsed_us) {
+  Serial.printf("  %-40s %8lld us  %6lu ns/item\n", name, elapsed_us,
+                (unsigned long)(elapsed_us * 1000 / BENCHMARK_ITERATIONS));
+}
+
+static BusCommand sample_command(uint32_t i) {
+  BusCommand command;
+  command.type = BUS_CMD_SET_BRIGHTNESS;
+  command.brightness = i & 0xFF;
+  return command;
+}
+
+// Same-task round trips: push one, pop one
+
+static void bench_command_ring() {
+  BusCommand command;
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    command_ring.push(sample_command(i));
+    command_ring.pop(command);
+    checksum = checksum + command.brightness;
+  }
+  report("SpscRing<BusCommand> push/pop", esp_timer_get_time() - start);
+}
+
+static void bench_command_queue() {
+  BusCommand command;
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    command = sample_command(i);
+    xQueueSend(command_queue, &command, 0);
+    xQueueReceive(command_queue, &command, 0);
+    checksum = checksum + command.brightness;
+  }
+  report("xQueue<BusCommand> send/receive", esp_timer_get_time() - start);
+}
+
+static void bench_packet_pool() {
+  PooledPacket* slot;
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    packet_ring.push(packet_pool.acquire(sample_frame, i & 1));
+    packet_ring.pop(slot);
+    checksum = checksum + slot->packet.data[1];
+    packet_pool.release(slot);
+  }
+  report("PacketPool + SpscRing<PooledPacket*>", esp_timer_get_time() - start);
+}
+
+static void bench_packet_heap() {
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    PooledPacket* slot = new PooledPacket();
+    slot->packet.setData(sample_frame);
+    slot->timestamp_us = esp_timer_get_time();
+    slot->bus_id = i & 1;
+    checksum = checksum + slot->packet.data[1];
+    delete slot;
+  }
+  report("new/delete PooledPacket", esp_timer_get_time() - start);
+}
+
+static void bench_packet_queue() {
+  PooledPacket slot;
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    slot.packet.setData(sample_frame);
+    slot.timestamp_us = esp_timer_get_time();
+    slot.bus_id = i & 1;
+    xQueueSend(packet_queue, &slot, 0);
+    xQueueReceive(packet_queue, &slot, 0);
+    checksum = checksum + slot.packet.data[1];
+  }
+  report("xQueue<PooledPacket> send/receive", esp_timer_get_time() - start);
+}
+
+// Task-to-task handoff. The producer (loop()'s task) sends BENCHMARK_ITERATIONS items and waits for the consumer
+// to say it has had them all
+
+static void ring_consumer(void* arg) {
+  BusCommand command;
+  uint32_t received = 0;
+  while (received < BENCHMARK_ITERATIONS) {
+    if (command_ring.pop(command)) {
+      checksum = checksum + command.brightness;
+      received++;
+    } else {
+      ulTaskNotifyTake(pdTRUE, 1);
+    }
+  }
+  xTaskNotifyGive(producer_task);
+  vTaskDelete(nullptr);
+}
+
+static void ring_producer() {
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    while (!command_ring.push(sample_command(i))) {
+      taskYIELD();
+    }
+    if (command_ring.size() == 1) {
+      xTaskNotifyGive(consumer_task);  // It may have gone to sleep on an empty ring
+    }
+  }
+}
+
+static void queue_consumer(void* arg) {
+  BusCommand command;
+  for (uint32_t received = 0; received < BENCHMARK_ITERATIONS; received++) {
+    xQueueReceive(command_queue, &command, portMAX_DELAY);
+    checksum = checksum + command.brightness;
+  }
+  xTaskNotifyGive(producer_task);
+  vTaskDelete(nullptr);
+}
+
+static void queue_producer() {
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    BusCommand command = sample_command(i);
+    xQueueSend(command_queue, &command, portMAX_DELAY);
+  }
+}
+
+static void pool_consumer(void* arg) {
+  PooledPacket* slot;
+  uint32_t received = 0;
+  while (received < BENCHMARK_ITERATIONS) {
+    if (packet_ring.pop(slot)) {
+      checksum = checksum + slot->packet.data[1];
+      packet_pool.release(slot);
+      received++;
+    } else {
+      ulTaskNotifyTake(pdTRUE, 1);
+    }
+  }
+  xTaskNotifyGive(producer_task);
+  vTaskDelete(nullptr);
+}
+
+static void pool_producer() {
+  for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    PooledPacket* slot;
+    while (!(slot = packet_pool.acquire(sample_frame, i & 1))) {
+      taskYIELD();  // Every slot is still with the consumer
+    }
+    packet_ring.push(slot);  // Can't be full - it is as deep as the pool
+    if (packet_ring.size() == 1) {
+      xTaskNotifyGive(consumer_task);
+    }
+  }
+}
+
+static void bench_cross_task(const char* name, TaskFunction_t consumer, void (*producer)()) {
+  ulTaskNotifyTake(pdTRUE, 0);  // Clear anything left over
+  int64_t start = esp_timer_get_time();
+#if portNUM_PROCESSORS > 1
+  xTaskCreatePinnedToCore(consumer, "bench", BENCHMARK_STACK_SIZE, nullptr, 1, &consumer_task, 0);
+#else
+  xTaskCreate(consumer, "bench", BENCHMARK_STACK_SIZE, nullptr, 1, &consumer_task);
+#endif
+  producer();
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  report(name, esp_timer_get_time() - start);
+}
+
+// Settings storage
+
+static void bench_littlefs_mount() {
+  LittleFS.end();
+  int64_t start = esp_timer_get_time();
+  bool mounted = LittleFS.begin(true);
+  Serial.printf("  %-40s %8lld us%s\n", "LittleFS mount", esp_timer_get_time() - start, mounted ? "" : " (failed)");
+}
+
+static void bench_settings_store(SettingsStore& store) {
+  int64_t start = esp_timer_get_time();
+  if (!store.begin()) {
+    Serial.printf("  %s: unavailable\n", store.getName());
+    return;
+  }
+  int64_t begin_us = esp_timer_get_time() - start;
+
+  BusSettings settings = {0x03, 0xd5, 0xff, 100, 0, 349200, 18000};
+  uint8_t record[BUS_SETTINGS_MAX_SIZE];
+  size_t length = 0;
+  int64_t save_total_us = 0;
+  int64_t save_max_us = 0;
+  uint32_t failures = 0;
+#ifdef CONFIG_SPI_FLASH_ENABLE_COUNTERS
+  esp_flash_reset_counters();
+#endif
+  for (uint32_t i = 0; i < BENCHMARK_STORAGE_SAVES; i++) {
+    settings.cartridge_active_seconds = i;  // A different record each time, as a real save would be
+    length = bus_settings_encode(settings, record, sizeof(record));
+    start = esp_timer_get_time();
+    if (!store.write(BENCHMARK_STORAGE_KEY, record, length)) {
+      failures++;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    save_total_us += elapsed;
+    if (elapsed > save_max_us) {
+      save_max_us = elapsed;
+    }
+  }
+#ifdef CONFIG_SPI_FLASH_ENABLE_COUNTERS
+  uint32_t flash_bytes = esp_flash_get_counters()->write.bytes;
+#endif
+
+  int64_t load_total_us = 0;
+  for (uint32_t i = 0; i < BENCHMARK_STORAGE_SAVES; i++) {
+    start = esp_timer_get_time();
+    size_t loaded = store.read(BENCHMARK_STORAGE_KEY, record, sizeof(record), bus_settings_valid);
+    if (bus_settings_decode(record, loaded, settings) == BUS_SETTINGS_INVALID) {
+      failures++;
+    }
+    load_total_us += esp_timer_get_time() - start;
+  }
+  store.remove(BENCHMARK_STORAGE_KEY);
+
+  Serial.printf("  %s (begin %lld us, %lu failures)\n", store.getName(), begin_us, (unsigned long)failures);
+  Serial.printf("    %-38s %8lld us\n", "save avg", save_total_us / BENCHMARK_STORAGE_SAVES);
+  Serial.printf("    %-38s %8lld us\n", "save max", save_max_us);
+  Serial.printf("    %-38s %8lld us\n", "load avg", load_total_us / BENCHMARK_STORAGE_SAVES);
+#ifdef CONFIG_SPI_FLASH_ENABLE_COUNTERS
+  Serial.printf("    %-38s %8lu bytes\n", "flash written per save", (unsigned long)(flash_bytes / BENCHMARK_STORAGE_SAVES));
+#else
+  Serial.printf("    %-38s %8d bytes (record only)\n", "written per save", length);
+#endif
+}
+
+void benchmark_setup() {
+  Serial.println("Handoff benchmarks starting...");
+  Serial.printf("%d iterations, depth %d, %d core(s)\n", BENCHMARK_ITERATIONS, BENCHMARK_DEPTH, portNUM_PROCESSORS);
+
+  command_queue = xQueueCreate(BENCHMARK_DEPTH, sizeof(BusCommand));
+  packet_queue = xQueueCreate(BENCHMARK_DEPTH, sizeof(PooledPacket));
+  producer_task = xTaskGetCurrentTaskHandle();
+
+  Serial.println("Same task:");
+  bench_command_ring();
+  bench_command_queue();
+  bench_packet_pool();
+  bench_packet_heap();
+  bench_packet_queue();
+
+  Serial.println("Task to task:");
+  bench_cross_task("SpscRing<BusCommand> + notify", ring_consumer, ring_producer);
+  bench_cross_task("xQueue<BusCommand>", queue_consumer, queue_producer);
+  bench_cross_task("PacketPool + SpscRing<PooledPacket*>", pool_consumer, pool_producer);
+
+  Serial.printf("Settings storage (%d saves):\n", BENCHMARK_STORAGE_SAVES);
+  bench_littlefs_mount();
+  bench_settings_store(littlefs_settings_store);
+  bench_settings_store(nvs_settings_store);
+
+  Serial.printf("Benchmarks complete (checksum %lu)\n", (unsigned long)checksum);
+}
+
+void benchmark_loop() {
+  delay(1000);
+}
+
+#endif // MODE_BENCHMARK
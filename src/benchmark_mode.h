@@ -0,0 +1,12 @@
+#ifndef BENCHMARK_MODE_H
+#define BENCHMARK_MODE_H
+
+#include <Arduino.h>
+
+// Initialize the benchmark mode (runs the handoff and settings storage benchmarks once and prints the results)
+void benchmark_setup();
+
+// Run the benchmark loop
+void benchmark_loop();
+
+#endif
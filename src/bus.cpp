@@ -1,17 +1,41 @@
 #include "bus.h"
+#include "bus_arbiter.h"
 #include "known_packets.h"
-#include <LittleFS.h>
-
-
-uint8_t active_bus_id = -1;  // Global variable to track the currently active bus ID
+#include "settings_store.h"
 
 
 // Constructor - initialize bus with ID and set pin assignments
 Bus::Bus(uint8_t id) : bus_id(id), bus_state(BUS_OFFLINE), 
+                       rx_index(0), rx_last_byte_at(0), rx_in_progress(false),
                        warm_on_at(0), active_seconds_last_save_at(0),
-                       last_polled(0),
+                       last_polled(0), next_poll_at(0),
+                       warm_up_phase(WARMUP_IDLE),
+                       task(nullptr), command_queue(nullptr), snapshot(),
+                       shutoff_timer(TIMER_INVALID), poll_timer(TIMER_INVALID), refresh_timer(TIMER_INVALID),
+                       runtime_timer(TIMER_INVALID),
+                       settings_timer(TIMER_INVALID), settings_dirty(false), settings_dirty_since(0),
+                       settings_changes(0), settings_flushes(0), settings_flush_last_us(0), settings_flush_max_us(0),
+                       pending_event_count(0), last_cartridge_percent(100),
+                       job_head(0), job_count(0), finished_count(0),
+                       desired_power(false), power_job_queued_at(0),
+                       color_pending(false), color_changed_at(0), brightness_pending(false), brightness_changed_at(0),
+                       color_commands(0), color_commands_coalesced(0), brightness_commands(0), brightness_commands_coalesced(0),
+                       powered_at(0), power_good_pending(false), last_power_good(false),
+                       last_power_up_ms(0), max_power_up_ms(0), power_up_count(0), power_up_timeouts(0),
                        red(0x03), green(0xd5), blue(0xff), brightness(100), cartridge_active_seconds(0),
                        cartridge_warn_at_seconds(349200), auto_shut_off_after_seconds(18000) {
+  portMUX_INITIALIZE(&job_mux);
+  portMUX_INITIALIZE(&snapshot_mux);
+
+#if BUS_WIRE_COUNT > 1
+  // A UART per bus
+  wire_id = (bus_id == 1) ? 1 : 0;
+  uart = (bus_id == 1) ? &Serial2 : &Serial1;
+#else
+  wire_id = 0;
+  uart = &Serial1;
+#endif
+
   // Set pin assignments based on bus ID
   if (bus_id == 0) {
     tx_pin = BUS_0_TX_PIN;
@@ -44,11 +68,11 @@ Bus::Bus(uint8_t id) : bus_id(id), bus_state(BUS_OFFLINE),
 void Bus::init() {
   if (dir_pin == -1) {
     Serial.printf("Bus %d: Invalid pin configuration\n", bus_id);
-    bus_state = BUS_ERROR;
+    set_state(BUS_ERROR);
     return;
   }
 
-  bus_state = BUS_OFFLINE;
+  set_state(BUS_OFFLINE);
   
   pinMode(dir_pin, OUTPUT);
   digitalWrite(dir_pin, LOW);  // Start in receive mode
@@ -61,9 +85,22 @@ void Bus::init() {
   
   // Load settings from filesystem
   load_settings();  
+
+  if (runtime_journal.begin(bus_id)) {
+    cartridge_active_seconds = runtime_journal.getTotalSeconds();
+  } else {
+    runtime_journal.reset(cartridge_active_seconds);  // First boot with a journal - carry the saved total over
+  }
+  Serial.printf("Bus %d: Cartridge active seconds %lu (%d journal records)\n", bus_id, cartridge_active_seconds,
+                runtime_journal.getRecordCount());
+
+  // Thresholds already crossed before this boot were reported then, so only later crossings are published
+  last_cartridge_percent = get_cartridge_percent_left();
+
+  usage_history.begin(bus_id);
 }
 
-// Activate the bus (Power on the bus (if unpowered) and set as Serial1)
+// Activate the bus (Power on the bus (if unpowered) and attach the UART to its pins)
 void Bus::activate() {
   if(bus_state == BUS_ERROR) {
     powerdown();  // Ensure we power down if in error state
@@ -74,28 +111,430 @@ void Bus::activate() {
   digitalWrite(dir_pin, LOW);  // Start in receive mode
 
   if(bus_state == BUS_OFFLINE) {
-    if(pow_pin != -1) {
-      digitalWrite(pow_pin, HIGH);  // Power on the bus
-      delay(1000); // Allow 1s for bus to power up
+    power_rail_on();  // Sets BUS_POWERED first so transmit() doesn't re-enter this branch while probing
+    attach_serial();
+    if(bus_state == BUS_ERROR) {
+      return;
+    }
+    wait_for_power_good();
+  }
+
+  attach_serial();
+}
+
+// Spawn the long-running flows for this bus and start its worker task
+void Bus::start() {
+  command_queue = xQueueCreate(BUS_COMMAND_QUEUE_DEPTH, sizeof(BusCommand));
+  if (!command_queue) {
+    Serial.printf("Bus %d: Failed to create command queue\n", bus_id);
+    set_state(BUS_ERROR);
+    return;
+  }
+
+  shutoff_timer = timer_service.add(on_shutoff_timer, this);
+  poll_timer = timer_service.add(on_poll_timer, this);
+  refresh_timer = timer_service.add(on_refresh_timer, this);
+  runtime_timer = timer_service.add(on_runtime_timer, this);
+  settings_timer = timer_service.add(on_settings_timer, this);
+  update_timers();
+
+  executor.spawn(job_flow());
+  executor.spawn(poll_flow());
+  executor.spawn(reconcile_flow());
+  publish_snapshot();
+
+  char name[8];
+  snprintf(name, sizeof(name), "bus%d", bus_id);
+  if (xTaskCreate(task_main, name, BUS_TASK_STACK_SIZE, this, BUS_TASK_PRIORITY, &task) != pdPASS) {
+    Serial.printf("Bus %d: Failed to create worker task\n", bus_id);
+    set_state(BUS_ERROR);
+  }
+}
+
+void Bus::task_main(void* arg) {
+  static_cast<Bus*>(arg)->run_worker();
+}
+
+// The worker sleeps until a flow is due, a command arrives, a signal is set or one of the bus's timers fires.
+// Nothing wakes it while the bus is idle; while the repellers are on, refresh_timer wakes it every
+// BUS_SNAPSHOT_INTERVAL_MS so the cartridge figures in the snapshot stay current.
+void Bus::run_worker() {
+  executor.set_task(xTaskGetCurrentTaskHandle());
+
+  while (true) {
+    BusCommand command;
+    while (xQueueReceive(command_queue, &command, 0) == pdTRUE) {
+      apply_command(command);
+    }
+
+    executor.run_once();
+    check_cartridge_thresholds();
+    publish_snapshot();
+    flush_events();
+    executor.wait_for_work(BUS_EXECUTOR_WAIT_FOREVER);
+  }
+}
+
+bool Bus::post(const BusCommand& command) {
+  if (!command_queue) {
+    apply_command(command);  // No worker (controller mode) - the caller owns the bus
+    return true;
+  }
+
+  if (xQueueSend(command_queue, &command, 0) != pdTRUE) {
+    Serial.printf("Bus %d: Command queue full, command %d dropped\n", bus_id, command.type);
+    return false;
+  }
+  executor.wake();
+  return true;
+}
+
+void Bus::apply_command(const BusCommand& command) {
+  switch (command.type) {
+    case BUS_CMD_SET_RGB:
+      apply_rgb(command.rgb.red, command.rgb.green, command.rgb.blue);
+      break;
+    case BUS_CMD_SET_BRIGHTNESS:
+      apply_brightness(command.brightness);
+      break;
+    case BUS_CMD_RESET_CARTRIDGE:
+      apply_reset_cartridge();
+      break;
+    case BUS_CMD_SET_WARN_AT:
+      apply_warn_at_seconds(command.warn_at_seconds);
+      break;
+    case BUS_CMD_SET_AUTO_SHUTOFF:
+      apply_auto_shut_off_seconds(command.auto_shut_off_seconds);
+      break;
+    case BUS_CMD_SET_POWER:
+      apply_power(command.power.on, command.power.job_queued);
+      break;
+    case BUS_CMD_CHECK_AUTO_SHUTOFF:
+      check_automatic_shutoff();
+      break;
+    case BUS_CMD_FLUSH_SETTINGS:
+      flush_settings();
+      break;
+    case BUS_CMD_CHECKPOINT_RUNTIME:
+      save_active_seconds();
+      break;
+  }
+}
+
+void Bus::publish_snapshot() {
+  BusSnapshot next;
+  next.state = bus_state;
+  next.desired_power = desired_power;
+  next.brightness = brightness;
+  next.red = red;
+  next.green = green;
+  next.blue = blue;
+  next.repeller_count = repellers.size();
+  uint8_t listed = 0;
+  for (const auto& repeller : repellers) {
+    if (listed == BUS_SNAPSHOT_REPELLERS) {
+      break;
+    }
+    RepellerSummary& summary = next.repellers[listed++];
+    summary.address = repeller.address;
+    summary.state = repeller.state;
+    memcpy(summary.serial, repeller.serial, sizeof(summary.serial));
+  }
+
+  next.color_commands = color_commands;
+  next.color_commands_coalesced = color_commands_coalesced;
+  next.brightness_commands = brightness_commands;
+  next.brightness_commands_coalesced = brightness_commands_coalesced;
+  next.command_latency_p50_ms = command_latency.percentile(50);
+  next.command_latency_p99_ms = command_latency.percentile(99);
+  next.command_latency_samples = command_latency.getCount();
+
+  next.warm_up_eta_ms = (bus_state == BUS_WARMING_UP) ? get_warm_up_eta_ms() : -1;
+  next.last_power_up_ms = last_power_up_ms;
+  next.max_power_up_ms = max_power_up_ms;
+  next.power_up_count = power_up_count;
+  next.power_up_timeouts = power_up_timeouts;
+
+  next.job = get_current_job();
+  if (next.job.id == 0) {
+    next.job = get_last_job();
+  }
+
+  next.cartridge_runtime_hours = get_cartridge_runtime_hours();
+  next.cartridge_percent_left = get_cartridge_percent_left();
+  next.cartridge_active_seconds = cartridge_active_seconds;
+  next.cartridge_warn_at_seconds = cartridge_warn_at_seconds;
+  next.auto_shut_off_after_seconds = auto_shut_off_after_seconds;
+  next.runtime_journal_records = runtime_journal.getRecordCount();
+  next.runtime_journal_compactions = runtime_journal.getCompactions();
+  next.usage_history_buckets = usage_history.getBucketCount();
+  next.usage_history_bytes = usage_history.getBytesUsed();
+
+  next.settings_changes = settings_changes;
+  next.settings_flushes = settings_flushes;
+  next.settings_flush_last_us = settings_flush_last_us;
+  next.settings_flush_max_us = settings_flush_max_us;
+  next.settings_dirty = settings_dirty;
+  next.published_at = millis();
+
+  portENTER_CRITICAL(&snapshot_mux);
+  snapshot = next;
+  portEXIT_CRITICAL(&snapshot_mux);
+}
+
+BusSnapshot Bus::get_snapshot() {
+  if (!task) {
+    publish_snapshot();  // No worker (controller mode) - the caller owns the bus
+  }
+
+  BusSnapshot copy;
+  portENTER_CRITICAL(&snapshot_mux);
+  copy = snapshot;
+  portEXIT_CRITICAL(&snapshot_mux);
+  return copy;
+}
+
+void Bus::emit(BusEvent event) {
+  event.bus_id = bus_id;  // Subscribers (and the flash log) tell the buses apart by this
+
+  if (!task) {
+    bus_events.publish(event);  // No worker (controller mode, or still in setup) - nothing to wait for
+    return;
+  }
+
+  if (pending_event_count == BUS_PENDING_EVENTS) {
+    publish_snapshot();
+    flush_events();
+  }
+  pending_events[pending_event_count++] = event;
+}
+
+void Bus::flush_events() {
+  for (uint8_t i = 0; i < pending_event_count; i++) {
+    bus_events.publish(pending_events[i]);
+  }
+  pending_event_count = 0;
+}
+
+void Bus::set_state(BusState state) {
+  if (state == bus_state) {
+    return;
+  }
+
+  BusEvent event = {};
+  event.type = BUS_EVENT_STATE_CHANGED;
+  event.state.from = bus_state;
+  event.state.to = state;
+  if (bus_state == BUS_OFFLINE && state != BUS_ERROR) {
+    usage_history.count_power_on();
+  }
+  bus_state = state;
+  update_timers();
+  emit(event);
+}
+
+void Bus::emit_timeout(BusTimeout what, uint8_t address) {
+  BusEvent event = {};
+  event.type = BUS_EVENT_TIMEOUT;
+  event.timeout.what = what;
+  event.timeout.address = address;
+  emit(event);
+}
+
+void Bus::set_repeller_state(Repeller& repeller, RepellerState state) {
+  if (state == repeller.state) {
+    return;
+  }
+
+  BusEvent event = {};
+  event.type = BUS_EVENT_REPELLER_CHANGED;
+  event.repeller.address = repeller.address;
+  event.repeller.from = repeller.state;
+  event.repeller.to = state;
+  repeller.state = state;
+  emit(event);
+}
+
+void Bus::publish_setting(BusSetting setting) {
+  BusEvent event = {};
+  event.type = BUS_EVENT_SETTINGS_CHANGED;
+  event.setting = setting;
+  emit(event);
+}
+
+// Publish once per threshold as the cartridge runs down (the lowest one, if several were passed at once)
+void Bus::check_cartridge_thresholds() {
+  static const uint8_t thresholds[] = BUS_CARTRIDGE_THRESHOLDS;
+  uint8_t percent_left = get_cartridge_percent_left();
+
+  int crossed = -1;
+  for (uint8_t threshold : thresholds) {
+    if (percent_left <= threshold && last_cartridge_percent > threshold) {
+      crossed = threshold;
+    }
+  }
+  last_cartridge_percent = percent_left;
+
+  if (crossed >= 0) {
+    BusEvent event = {};
+    event.type = BUS_EVENT_CARTRIDGE_THRESHOLD;
+    event.cartridge.threshold = crossed;
+    event.cartridge.percent_left = percent_left;
+    emit(event);
+  }
+}
+
+void Bus::check_automatic_shutoff() {
+  if ((bus_state == BUS_WARMING_UP || bus_state == BUS_REPELLING) && desired_power && past_automatic_shutoff()) {
+    Serial.printf("Bus %d: Auto shutoff triggered\n", bus_id);
+    usage_history.count_auto_shutoff();
+
+    BusEvent event = {};
+    event.type = BUS_EVENT_AUTO_SHUTOFF;
+    event.auto_shutoff_seconds = auto_shut_off_after_seconds;
+    emit(event);
+    ZigbeePowerOff();
+  }
+}
+
+void Bus::on_shutoff_timer(void* arg) {
+  BusCommand command;
+  command.type = BUS_CMD_CHECK_AUTO_SHUTOFF;
+  static_cast<Bus*>(arg)->post(command);
+}
+
+void Bus::on_poll_timer(void* arg) {
+  static_cast<Bus*>(arg)->poll_signal.set();
+}
+
+void Bus::on_refresh_timer(void* arg) {
+  static_cast<Bus*>(arg)->executor.wake();
+}
+
+void Bus::on_runtime_timer(void* arg) {
+  BusCommand command;
+  command.type = BUS_CMD_CHECKPOINT_RUNTIME;
+  static_cast<Bus*>(arg)->post(command);
+}
+
+void Bus::on_settings_timer(void* arg) {
+  BusCommand command;
+  command.type = BUS_CMD_FLUSH_SETTINGS;
+  static_cast<Bus*>(arg)->post(command);
+}
+
+// Called on every state change (warm_on_at is set just before the bus enters BUS_WARMING_UP) and when the
+// auto shut-off setting changes
+void Bus::update_timers() {
+  if (shutoff_timer == TIMER_INVALID) {
+    return;  // Not started (controller mode)
+  }
+
+  bool on = (bus_state == BUS_WARMING_UP || bus_state == BUS_REPELLING);
+
+  if (on && auto_shut_off_after_seconds > 0 && warm_on_at != 0) {
+    timer_service.arm_at(shutoff_timer, warm_on_at + (uint64_t)auto_shut_off_after_seconds * 1000000);
+  } else {
+    timer_service.disarm(shutoff_timer);
+  }
+
+  if (on) {
+    if (!timer_service.isArmed(refresh_timer)) {
+      timer_service.arm_periodic(refresh_timer, BUS_SNAPSHOT_INTERVAL_MS);
+    }
+    if (!timer_service.isArmed(runtime_timer)) {
+      timer_service.arm_periodic(runtime_timer, RUNTIME_JOURNAL_CHECKPOINT_MS);
     }
-    bus_state = BUS_POWERED;
+  } else {
+    timer_service.disarm(refresh_timer);
+    timer_service.disarm(runtime_timer);
+    timer_service.disarm(poll_timer);
+  }
+}
+
+// Raise the power pin without waiting for the bus to come up. The power-good probes are then sent by
+// power_good(), which gives up the wire between probes so that another bus can use it (and bring its own
+// rail up) in the meantime.
+void Bus::power_rail_on() {
+  if(bus_state != BUS_OFFLINE) {
+    return;
   }
 
-  // Initialize Serial1 for RS-485 communication
-  if(active_bus_id != bus_id) {
+  digitalWrite(dir_pin, LOW);  // Start in receive mode
+  set_state(BUS_POWERED);
+  powered_at = millis();
+
+  if(pow_pin != -1) {
+    digitalWrite(pow_pin, HIGH);  // Power on the bus
+    power_good_pending = true;
+  }
+}
+
+// Initialize the UART for RS-485 communication on this bus's pins. Where the buses share a UART, this is only
+// called by the holder of the wire.
+void Bus::attach_serial() {
+  if(bus_arbiter.getAttachedBus(wire_id) != bus_id) {
     if (bus_id == 0 || (bus_id == 1 && tx_pin != -1)) {
-      Serial1.begin(19200, SERIAL_8N1, rx_pin, tx_pin);  // Will detatch the previous pins if set
+      uart->begin(19200, SERIAL_8N1, rx_pin, tx_pin);  // Will detatch the previous pins if set
       // Clear any existing data
-      while(Serial1.available()) {
-        Serial1.read();
+      while(uart->available()) {
+        uart->read();
       }
+      rx_index = 0;
+      rx_in_progress = false;
       Serial.printf("Bus %d initialized successfully\n", bus_id);
-      active_bus_id = bus_id;  // Set this bus as the active one
+      bus_arbiter.setAttachedBus(wire_id, bus_id);  // Set this bus as the active one
     } else {
       Serial.printf("Bus %d: Failed to initialize\n", bus_id);
-      bus_state = BUS_ERROR;
+      set_state(BUS_ERROR);
+    }
+  }
+}
+
+// Rather than sleeping a fixed second after raising the power pin, probe with tx_discover until the first
+// valid frame comes back. Gives up after BUS_POWER_GOOD_MAX_MS (an empty bus will never answer). The
+// measured latency is kept per bus so BUS_POWER_GOOD_MAX_MS can be tuned from field data.
+bool Bus::wait_for_power_good() {
+  return executor.run_until_complete(power_good());
+}
+
+Task<bool> Bus::power_good() {
+  while (power_good_pending) {
+    if (millis() - powered_at >= BUS_POWER_GOOD_MAX_MS) {
+      power_good_pending = false;
+      last_power_good = false;
+      last_power_up_ms = BUS_POWER_GOOD_MAX_MS;
+      power_up_timeouts++;
+      Serial.printf("Bus %d: No response within %d ms of power up\n", bus_id, BUS_POWER_GOOD_MAX_MS);
+      emit_timeout(BUS_TIMEOUT_POWER_UP, 0);
+      break;
+    }
+
+    BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_PROTOCOL);
+    Packet probe;
+    probe.setAsTxDiscover();
+    co_await send(probe);
+
+    if (co_await receive(BUS_POWER_GOOD_PROBE_MS) && last_response.isValid()) {
+      // A repeller that already has an address answers the probe the same way it would answer discovery,
+      // so keep track of it here rather than relying on it answering again.
+      if (last_response.identifyPacket() == RX_STARTUP) {
+        Repeller* repeller = get_or_create_repeller(last_response.getAddress());
+        set_repeller_state(*repeller, INACTIVE);
+      }
+
+      power_good_pending = false;
+      last_power_good = true;
+      last_power_up_ms = millis() - powered_at;
+      if (last_power_up_ms > max_power_up_ms) {
+        max_power_up_ms = last_power_up_ms;
+      }
+      power_up_count++;
+      Serial.printf("Bus %d: Power good after %u ms\n", bus_id, last_power_up_ms);
     }
   }
+
+  co_return last_power_good;
 }
 
 // Power down (deactivate) the bus
@@ -108,37 +547,59 @@ void Bus::powerdown() {
     } else {
       Serial.printf("Bus %d: powerdown: no power pin\n", bus_id);
     }
-    bus_state = BUS_OFFLINE;
+    save_active_seconds();  // While the state still says the repellers were on
+    set_state(BUS_OFFLINE);
+    power_good_pending = false;
+    flush_settings();  // Don't leave changes in RAM once the bus is off
+    repeller_ledger.flush();
+    usage_history.save();
   } else {
     Serial.printf("Bus %d: powerdown: bus already offline\n", bus_id);
   }
 
-  if(active_bus_id == bus_id) {
-    active_bus_id = -1;
+  if(bus_arbiter.getAttachedBus(wire_id) == bus_id) {
+    bus_arbiter.setAttachedBus(wire_id, -1);
   }
 }
 
 // Transmit packet on this bus
 void Bus::transmit(Packet *packet) {
   activate();  // Ensure the bus is active before transmitting
-  
+  transmit_frame(packet);
+  delay(100);  // Allow some time before next operation
+}
+
+// Awaitable transmit for the protocol flows. The bus must already be powered - a flow that finds it has
+// been shut down underneath it just has its frames dropped.
+Task<> Bus::send(Packet packet) {
+  transmit_frame(&packet);
+  co_await sleep_for(100);  // Allow some time before next operation
+}
+
+void Bus::transmit_frame(Packet *packet) {
   if (!packet) {
     Serial.printf("Bus %d: Cannot transmit null packet\n", bus_id);
     return;
   }
-  
+
+  if (bus_state == BUS_OFFLINE || bus_state == BUS_ERROR) {
+    Serial.printf("Bus %d: Not transmitting on a bus that is %s\n", bus_id, getStateString());
+    return;
+  }
+
+  attach_serial();
+
   // Set RS-485 transceiver to transmit mode for this bus
   digitalWrite(dir_pin, HIGH);
   delayMicroseconds(20);  // Give DE time to enable
   
   // Send the packet
-  Serial1.write(packet->data, sizeof(packet->data));
-  Serial1.flush();  // Wait until transmission complete
+  uart->write(packet->data, sizeof(packet->data));
+  uart->flush();  // Wait until transmission complete
   
   // Back to receive mode
   delayMicroseconds(20);  // Give time for transmission to complete
   digitalWrite(dir_pin, LOW);
-  delay(100);  // Allow some time before next operation
 }
 
 // Helper function to receive and print a packet with timeout
@@ -156,18 +617,47 @@ bool Bus::receive_and_print(const char* expected_type, uint16_t timeout_ms) {
 
 // Packet-based receive function
 bool Bus::receive_packet(Packet& packet, uint16_t timeout_ms) {
-  static uint8_t rx_buffer[11];
-  static size_t buffer_index = 0;
-  static unsigned long last_byte_time = 0;
-  static bool packet_in_progress = false;
-  
-  const unsigned long PACKET_TIMEOUT_MS = 8;  // Same as sniffer
-  unsigned long start_time = millis();
-  unsigned long current_time;
-  
   // Ensure this bus is active and we're in receive mode
   activate();
   digitalWrite(dir_pin, LOW);
+
+  return read_packet(packet, timeout_ms);
+}
+
+bool Bus::poll_packet(Packet& packet) {
+  if (bus_state == BUS_OFFLINE || bus_state == BUS_ERROR) {
+    return false;
+  }
+
+  attach_serial();
+  digitalWrite(dir_pin, LOW);
+
+  return read_packet(packet, 0);
+}
+
+PacketAwaiter Bus::receive(uint16_t timeout_ms) {
+  return PacketAwaiter(this, &last_response, timeout_ms);
+}
+
+Task<ExpectResult> Bus::expect(PacketType type, uint16_t timeout_ms) {
+  if (!co_await receive(timeout_ms)) {
+    co_return EXPECT_TIMEOUT;
+  }
+  co_return last_response.identifyPacket() == type ? EXPECT_MATCHED : EXPECT_UNEXPECTED;
+}
+
+Task<ExpectResult> Bus::request(Packet packet, PacketType expected, BusPriority priority, uint16_t timeout_ms) {
+  BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, priority);
+  co_await send(packet);
+  co_return co_await expect(expected, timeout_ms);
+}
+
+// The parser state is kept per bus, so a frame half-read by one worker is never completed with bytes from the
+// other bus.
+bool Bus::read_packet(Packet& packet, uint16_t timeout_ms) {
+  const unsigned long PACKET_TIMEOUT_MS = 8;  // Same as sniffer
+  unsigned long start_time = millis();
+  unsigned long current_time;
   
   while (true) {
     current_time = millis();
@@ -178,69 +668,69 @@ bool Bus::receive_packet(Packet& packet, uint16_t timeout_ms) {
     }
     
     // Check for packet timeout (gap between bytes)
-    if (packet_in_progress && (current_time - last_byte_time) > PACKET_TIMEOUT_MS) {
-      if (buffer_index == 11) {
+    if (rx_in_progress && (current_time - rx_last_byte_at) > PACKET_TIMEOUT_MS) {
+      if (rx_index == 11) {
         // Complete 11-byte packet received
         packet.setData(rx_buffer);
-        buffer_index = 0;
-        packet_in_progress = false;
+        rx_index = 0;
+        rx_in_progress = false;
         return true;
       } else {
         // Incomplete packet, reset
-        buffer_index = 0;
-        packet_in_progress = false;
+        rx_index = 0;
+        rx_in_progress = false;
       }
     }
     
     // Read available data
-    while (Serial1.available()) {
-      uint8_t byte_received = Serial1.read();
+    while (uart->available()) {
+      uint8_t byte_received = uart->read();
       current_time = millis();
       
       // If we haven't received data for a while, this might be a new packet
-      if (!packet_in_progress || (current_time - last_byte_time) > PACKET_TIMEOUT_MS) {
-        if (packet_in_progress && buffer_index == 11) {
+      if (!rx_in_progress || (current_time - rx_last_byte_at) > PACKET_TIMEOUT_MS) {
+        if (rx_in_progress && rx_index == 11) {
           // Previous complete packet available
           packet.setData(rx_buffer);
-          buffer_index = 0;
-          packet_in_progress = false;
+          rx_index = 0;
+          rx_in_progress = false;
           return true;
         }
-        buffer_index = 0;
-        packet_in_progress = true;
+        rx_index = 0;
+        rx_in_progress = true;
       }
       
       // Check if this byte is 0xAA (sync byte) and we're not at the start of a packet
-      if (byte_received == 0xAA && buffer_index > 0) {
+      if (byte_received == 0xAA && rx_index > 0) {
         // We found a sync byte but we already have data in the buffer
         // This indicates extra bytes before the real packet
-        Serial.printf("Bus %d: Found 0xAA at position %d, discarding %d bytes: ", bus_id, buffer_index, buffer_index);
-        for (size_t i = 0; i < buffer_index; i++) {
+        Serial.printf("Bus %d: Found 0xAA at position %d, discarding %d bytes: ", bus_id, rx_index, rx_index);
+        for (size_t i = 0; i < rx_index; i++) {
           Serial.printf("%02X ", rx_buffer[i]);
         }
         Serial.println();
         
         // Reset buffer and start fresh with this 0xAA byte
-        buffer_index = 0;
-        packet_in_progress = true;
+        rx_index = 0;
+        rx_in_progress = true;
       }
       
       // Add byte to buffer
-      if (buffer_index < 11) {
-        rx_buffer[buffer_index++] = byte_received;
+      if (rx_index < 11) {
+        rx_buffer[rx_index++] = byte_received;
       } else {
         // Buffer overflow, reset
-        buffer_index = 0;
-        packet_in_progress = false;
+        rx_index = 0;
+        rx_in_progress = false;
       }
       
-      last_byte_time = current_time;
+      rx_last_byte_at = current_time;
       
       // Check if we have a complete packet
-      if (buffer_index == 11) {
+      if (rx_index == 11) {
         packet.setData(rx_buffer);
-        buffer_index = 0;
-        packet_in_progress = false;
+        rx_index = 0;
+        rx_in_progress = false;
         return true;
       }
     }
@@ -374,6 +864,14 @@ Repeller* Bus::get_or_create_repeller(uint8_t address) {
   
   // Create new repeller and add to list
   repellers.emplace_back(address);
+
+  BusEvent event = {};
+  event.type = BUS_EVENT_REPELLER_CHANGED;
+  event.repeller.address = address;
+  event.repeller.from = OFFLINE;
+  event.repeller.to = repellers.back().state;
+  emit(event);
+
   return &repellers.back();
 }
 
@@ -390,32 +888,34 @@ uint8_t Bus::find_next_address() {
 
 
 // Discover all repellers on the bus by sending broadcast tx_startup commands
-void Bus::discover_repellers() {
+Task<> Bus::discover() {
   Serial.printf("Bus %d: Discovering repellers on the bus...\n", bus_id);
-  
-  Packet received_packet;
-  int consecutive_no_response = 0;
-  int total_discovered = 0;
-  
-  while (consecutive_no_response < 3) {
+  int no_response = 0;
+  int total = 0;
+
+  while (no_response < 3) {
+    BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_PROTOCOL);
+
     // Send broadcast tx_startup
     Serial.printf("Bus %d: Sending tx_discover broadcast...\n", bus_id);
-    send_tx_discover();
-    
+    Packet packet;
+    packet.setAsTxDiscover();
+    co_await send(packet);
+
     // Wait for response with 100ms timeout
-    if (receive_packet(received_packet, 100)) {
-      if(received_packet.identifyPacket() == RX_STARTUP) {
-        uint8_t device_address = received_packet.getAddress();
+    if (co_await receive(100)) {
+      if(last_response.identifyPacket() == RX_STARTUP) {
+        uint8_t device_address = last_response.getAddress();
         Serial.printf("Bus %d: Discovered repeller at address 0x%02X\n", bus_id, device_address);
-        
+
         // Create or get the repeller
         Repeller* repeller = get_or_create_repeller(device_address);
-        repeller->state = INACTIVE;
-        
-        total_discovered++;
-        consecutive_no_response = 0;  // Reset counter
-        
-      } else if(received_packet.identifyPacket() == RX_STARTUP_00) {
+        set_repeller_state(*repeller, INACTIVE);
+
+        total++;
+        no_response = 0;  // Reset counter
+
+      } else if(last_response.identifyPacket() == RX_STARTUP_00) {
         // Special case for RX_STARTUP_00, which indicates the repeller is not set up yet
         Serial.printf("Bus %d: Received RX_STARTUP_00, indicating no address set yet\n", bus_id);
 
@@ -425,44 +925,50 @@ void Bus::discover_repellers() {
 
         if(available_address == 0x20) {
           Serial.printf("Bus %d: No available addresses found for new repeller\n", bus_id);
-          consecutive_no_response++;
-          continue;  // Skip to next iteration
+          no_response++;
+          continue;
         }
 
         // Once we've found an available address, we can set it on the repeller
         Serial.printf("Bus %d: Setting repeller address to 0x%02X\n", bus_id, available_address);
-        send_set_address(available_address);
+        packet.setAsSetAddress(available_address);
+        co_await send(packet);
 
         // I THINK there is a response here that I could read, which I THINK is an incomplete packet 
-        if (receive_packet(received_packet, 500)) {
+        if (co_await receive(500)) {
           Serial.printf("Bus %d: Received set response packet\n", bus_id);
-          received_packet.print();
+          last_response.print();
         }
 
         // The repeller should theoretically respond to the next tx_discover - but let's add it to the list now
         // so we don't try to create a duplicate.
         // Create a new repeller with the available address
         Repeller* repeller = get_or_create_repeller(available_address);
-        repeller->state = INACTIVE;
-        
-        total_discovered++;
-        consecutive_no_response = 0;  // Reset counter
+        set_repeller_state(*repeller, INACTIVE);
+
+        total++;
+        no_response = 0;  // Reset counter
       } else {
         // Received packet but not rx_startup, print it for debugging
-        received_packet.print();
-        consecutive_no_response++;
+        last_response.print();
+        no_response++;
       }
     } else {
       // No response received
       Serial.printf("Bus %d: No response to tx_discover\n", bus_id);
-      consecutive_no_response++;
+      no_response++;
     }
   }
-  
-  Serial.printf("Bus %d: Repeller discovery complete. Found %d devices.\n", bus_id, total_discovered);
+
+  Serial.printf("Bus %d: Repeller discovery complete. Found %d devices.\n", bus_id, total);
+
+  BusEvent event = {};
+  event.type = BUS_EVENT_DISCOVERY;
+  event.found = total;
+  emit(event);
   
   // Print discovered repellers
-  if (total_discovered > 0) {
+  if (total > 0) {
     Serial.printf("Bus %d: Discovered repellers:\n", bus_id);
     for (const auto& repeller : repellers) {
       Serial.printf("  Address: 0x%02X, State: %s\n", repeller.address, repeller.getStateString());
@@ -470,80 +976,88 @@ void Bus::discover_repellers() {
   }
 }
 
-void Bus::retrieve_serial(Repeller* repeller) {
+Task<> Bus::retrieve_serial(Repeller* repeller) {
   if (!repeller) {
     Serial.printf("Bus %d: Invalid repeller pointer\n", bus_id);
-    return;
+    co_return;
   }
   
   // Send tx_ser_no_1 and wait for response
-  send_tx_ser_no_1(repeller->address);
-  Packet response_packet;
-  
-  if (receive_packet(response_packet, 1000)) {
-    if (response_packet.identifyPacket() == RX_SER_NO_1) {
-      // Extract serial number part 1
-      char serial_part1[9];
-      for (int i = 0; i < 8; i++) {
-        serial_part1[i] = (response_packet.data[i + 3] >= 32 && response_packet.data[i + 3] <= 126) ? response_packet.data[i + 3] : '.';
-      }
-      serial_part1[8] = '\0'; // Null-terminate the string
-      
-      // Send tx_ser_no_2 and wait for response
-      send_tx_ser_no_2(repeller->address);
-      
-      if (receive_packet(response_packet, 1000)) {
-        if (response_packet.identifyPacket() == RX_SER_NO_2) {
-          // Extract serial number part 2
-          char serial_part2[9];
-          for (int i = 0; i < 8; i++) {
-            serial_part2[i] = (response_packet.data[i + 3] >= 32 && response_packet.data[i + 3] <= 126) ? response_packet.data[i + 3] : '.';
-          }
-          serial_part2[8] = '\0'; // Null-terminate the string
-          
-          // Combine both parts into the repeller's serial
-          repeller->setSerial(serial_part1, serial_part2);
-          Serial.printf("Bus %d: Retrieved serial number: %s\n", bus_id, repeller->serial);
-        } else {
-          Serial.printf("Bus %d: Failed to retrieve serial number part 2\n", bus_id);
-        }
-      } else {
-        Serial.printf("Bus %d: No response for tx_ser_no_2\n", bus_id);
-      }
-    } else {
-      Serial.printf("Bus %d: Failed to retrieve serial number part 1\n", bus_id);
-    }
-  } else {
+  Packet packet;
+  packet.setAsTxSerNo1(repeller->address);
+  ExpectResult result = co_await request(packet, RX_SER_NO_1, BUS_PRIORITY_PROTOCOL);
+
+  if (result == EXPECT_TIMEOUT) {
     Serial.printf("Bus %d: No response for tx_ser_no_1\n", bus_id);
+    emit_timeout(BUS_TIMEOUT_SERIAL, repeller->address);
+    co_return;
+  } else if (result != EXPECT_MATCHED) {
+    Serial.printf("Bus %d: Failed to retrieve serial number part 1\n", bus_id);
+    co_return;
+  }
+
+  // Extract serial number part 1
+  char serial_part1[9];
+  for (int i = 0; i < 8; i++) {
+    serial_part1[i] = (last_response.data[i + 3] >= 32 && last_response.data[i + 3] <= 126) ? last_response.data[i + 3] : '.';
+  }
+  serial_part1[8] = '\0'; // Null-terminate the string
+
+  // Send tx_ser_no_2 and wait for response
+  packet.setAsTxSerNo2(repeller->address);
+  result = co_await request(packet, RX_SER_NO_2, BUS_PRIORITY_PROTOCOL);
+
+  if (result == EXPECT_TIMEOUT) {
+    Serial.printf("Bus %d: No response for tx_ser_no_2\n", bus_id);
+    emit_timeout(BUS_TIMEOUT_SERIAL, repeller->address);
+    co_return;
+  } else if (result != EXPECT_MATCHED) {
+    Serial.printf("Bus %d: Failed to retrieve serial number part 2\n", bus_id);
+    co_return;
+  }
+
+  // Extract serial number part 2
+  char serial_part2[9];
+  for (int i = 0; i < 8; i++) {
+    serial_part2[i] = (last_response.data[i + 3] >= 32 && last_response.data[i + 3] <= 126) ? last_response.data[i + 3] : '.';
+  }
+  serial_part2[8] = '\0'; // Null-terminate the string
+
+  // Combine both parts into the repeller's serial
+  repeller->setSerial(serial_part1, serial_part2);
+  repeller_ledger.touch(repeller->serial, bus_id);
+  RepellerLedgerEntry entry;
+  if (repeller_ledger.lookup(repeller->serial, entry)) {
+    repeller->warmup_complete_at = entry.warmup_complete_at;  // So the first warm-up after a boot has an ETA
   }
+  Serial.printf("Bus %d: Retrieved serial number: %s\n", bus_id, repeller->serial);
 }
 
-void Bus::send_tx_warmup(Repeller* repeller) {
+Task<> Bus::send_tx_warmup(Repeller* repeller) {
   if (!repeller) {
     Serial.printf("Bus %d: Invalid repeller pointer\n", bus_id);
-    return;
+    co_return;
   }
   
   // Send tx_warmup and wait for response
-  send_tx_warmup(repeller->address);
-  Packet response_packet;
-  
-  if (receive_packet(response_packet, 1000)) {
-    if (response_packet.identifyPacket() == RX_WARMUP) {
-      Serial.printf("Bus %d: Repeller 0x%02X warming up\n", bus_id, repeller->address);
-    } else {
-      // TODO - Print the packet here
-      Serial.printf("Bus %d: Invalid response packet received\n", bus_id);
-    }
+  Packet packet;
+  packet.setAsTxWarmup(repeller->address);
+  ExpectResult result = co_await request(packet, RX_WARMUP, BUS_PRIORITY_PROTOCOL);
+
+  if (result == EXPECT_MATCHED) {
+    Serial.printf("Bus %d: Repeller 0x%02X warming up\n", bus_id, repeller->address);
+  } else if (result == EXPECT_UNEXPECTED) {
+    Serial.printf("Bus %d: Invalid response packet received: ", bus_id);
+    last_response.print();
   } else {
     Serial.printf("Bus %d: Repeller 0x%02X failed to respond to TX_WARMUP\n", bus_id, repeller->address);
   }
 }
 
-void Bus::send_startup_led_params(Repeller* repeller) {
+Task<> Bus::send_startup_led_params(Repeller* repeller) {
   if (!repeller) {
     Serial.printf("Bus %d: Invalid repeller pointer\n", bus_id);
-    return;
+    co_return;
   }
   
   Serial.printf("Bus %d: Setting startup LED parameters for repeller 0x%02X...\n", bus_id, repeller->address);
@@ -552,18 +1066,18 @@ void Bus::send_startup_led_params(Repeller* repeller) {
   // 1. Send tx_color_startup with red, green, blue values and then look for rx_color_startup
   Serial.printf("Bus %d: Setting startup color for repeller 0x%02X...\n", bus_id, repeller->address);
   // Use the configured color from settings
-  send_tx_color_startup(repeller->address, repeller_red(), repeller_green(), repeller_blue());
-  
-  Packet response_packet;
-  if (receive_packet(response_packet, 1000)) {
-    if (response_packet.identifyPacket() == RX_COLOR_STARTUP) {
-      // Note - The response contains the color values as well (I think??), but the colors do not necessarily match what we sent
-      // For now, I'm just ignoring them.
-      Serial.printf("Bus %d: Repeller 0x%02X confirmed startup color\n", bus_id, repeller->address);
-    } else {
-      Serial.printf("Bus %d: Repeller 0x%02X sent unexpected color response: ", bus_id, repeller->address);
-      response_packet.print();
-    }
+  Packet packet;
+  packet.setAsTxColorStartup(repeller->address, repeller_red(), repeller_green(), repeller_blue());
+  ExpectResult result = co_await request(packet, RX_COLOR_STARTUP, BUS_PRIORITY_PROTOCOL);
+
+  if (result == EXPECT_MATCHED) {
+    // Note - The response contains the color values as well (I think??), but the colors do not necessarily match what we sent
+    // For now, I'm just ignoring them.
+    repeller->setAppliedColor(repeller_red(), repeller_green(), repeller_blue());
+    Serial.printf("Bus %d: Repeller 0x%02X confirmed startup color\n", bus_id, repeller->address);
+  } else if (result == EXPECT_UNEXPECTED) {
+    Serial.printf("Bus %d: Repeller 0x%02X sent unexpected color response: ", bus_id, repeller->address);
+    last_response.print();
   } else {
     Serial.printf("Bus %d: No color startup response from repeller 0x%02X\n", bus_id, repeller->address);
   }
@@ -571,30 +1085,31 @@ void Bus::send_startup_led_params(Repeller* repeller) {
   // 2. Send tx_led_brightness_startup with brightness value and then look for rx_led_brightness_startup
   Serial.printf("Bus %d: Setting startup brightness for repeller 0x%02X...\n", bus_id, repeller->address);
   // Use the configured brightness from settings
-  send_tx_led_brightness_startup(repeller->address, repeller_brightness());
-  
-  if (receive_packet(response_packet, 1000)) {
-    if (response_packet.identifyPacket() == RX_LED_BRIGHTNESS_STARTUP) {
-      Serial.printf("Bus %d: Repeller 0x%02X confirmed startup brightness\n", bus_id, repeller->address);
-    } else {
-      Serial.printf("Bus %d: Repeller 0x%02X sent unexpected brightness response: ", bus_id, repeller->address);
-      response_packet.print();
-    }
+  uint8_t startup_brightness = repeller_brightness();
+  packet.setAsTxLEDStartup(repeller->address, startup_brightness);
+  result = co_await request(packet, RX_LED_BRIGHTNESS_STARTUP, BUS_PRIORITY_PROTOCOL);
+
+  if (result == EXPECT_MATCHED) {
+    repeller->applied_brightness = startup_brightness;
+    repeller->brightness_applied = true;
+    Serial.printf("Bus %d: Repeller 0x%02X confirmed startup brightness\n", bus_id, repeller->address);
+  } else if (result == EXPECT_UNEXPECTED) {
+    Serial.printf("Bus %d: Repeller 0x%02X sent unexpected brightness response: ", bus_id, repeller->address);
+    last_response.print();
   } else {
     Serial.printf("Bus %d: No LED startup response from repeller 0x%02X\n", bus_id, repeller->address);
   }
   
   // 3. Send tx_startup_comp and then look for rx_startup_comp
   Serial.printf("Bus %d: Sending startup complete to repeller 0x%02X...\n", bus_id, repeller->address);
-  send_tx_startup_comp(repeller->address);
-  
-  if (receive_packet(response_packet, 1000)) {
-    if (response_packet.identifyPacket() == RX_STARTUP_COMP) {
-      Serial.printf("Bus %d: Repeller 0x%02X confirmed startup complete\n", bus_id, repeller->address);
-    } else {
-      Serial.printf("Bus %d: Repeller 0x%02X sent unexpected startup complete response: ", bus_id, repeller->address);
-      response_packet.print();
-    }
+  packet.setAsTxStartupComp(repeller->address);
+  result = co_await request(packet, RX_STARTUP_COMP, BUS_PRIORITY_PROTOCOL);
+
+  if (result == EXPECT_MATCHED) {
+    Serial.printf("Bus %d: Repeller 0x%02X confirmed startup complete\n", bus_id, repeller->address);
+  } else if (result == EXPECT_UNEXPECTED) {
+    Serial.printf("Bus %d: Repeller 0x%02X sent unexpected startup complete response: ", bus_id, repeller->address);
+    last_response.print();
   } else {
     Serial.printf("Bus %d: No startup complete response from repeller 0x%02X\n", bus_id, repeller->address);
   }
@@ -602,28 +1117,27 @@ void Bus::send_startup_led_params(Repeller* repeller) {
   Serial.printf("Bus %d: LED parameter setup complete for repeller 0x%02X\n", bus_id, repeller->address);
 }
 
-void Bus::send_led_on_to_repeller(Repeller *repeller) {
-  Packet response_packet;
+Task<> Bus::send_led_on_to_repeller(Repeller *repeller, BusPriority priority) {
   // 2. send_tx_led_on_conf and look for RX_LED_ON_CONF
   Serial.printf("Bus %d: Sending LED on confirmation to repeller 0x%02X...\n", bus_id, repeller->address);
-  send_tx_led_on_conf(repeller->address);
-  
-  if (receive_packet(response_packet, 1000)) {
-    if (response_packet.identifyPacket() == RX_LED_ON_CONF) {
-      Serial.printf("Bus %d: Repeller 0x%02X confirmed LED activation\n", bus_id, repeller->address);
-    } else {
-      Serial.printf("Bus %d: Repeller 0x%02X sent unexpected LED on response: ", bus_id, repeller->address);
-      response_packet.print();
-    }
+  Packet packet;
+  packet.setAsTxLEDOnConf(repeller->address);
+  ExpectResult result = co_await request(packet, RX_LED_ON_CONF, priority);
+
+  if (result == EXPECT_MATCHED) {
+    Serial.printf("Bus %d: Repeller 0x%02X confirmed LED activation\n", bus_id, repeller->address);
+  } else if (result == EXPECT_UNEXPECTED) {
+    Serial.printf("Bus %d: Repeller 0x%02X sent unexpected LED on response: ", bus_id, repeller->address);
+    last_response.print();
   } else {
     Serial.printf("Bus %d: No LED on confirmation response from repeller 0x%02X\n", bus_id, repeller->address);
   }
 }
 
-void Bus::send_activate_at_end_of_warmup(Repeller *repeller) {
+Task<> Bus::send_activate_at_end_of_warmup(Repeller *repeller) {
   if (!repeller) {
     Serial.printf("Bus %d: Invalid repeller pointer\n", bus_id);
-    return;
+    co_return;
   }
 
   Serial.printf("Bus %d: Activating repeller 0x%02X at end of warmup...\n", bus_id, repeller->address);
@@ -633,27 +1147,26 @@ void Bus::send_activate_at_end_of_warmup(Repeller *repeller) {
 
   // 1. send_tx_warmup_complete and look for RX_WARMUP_COMPLETE
   Serial.printf("Bus %d: Sending warmup complete to repeller 0x%02X...\n", bus_id, repeller->address);
-  send_tx_warmup_complete(repeller->address);
-  
-  Packet response_packet;
-  if (receive_packet(response_packet, 1000)) {
-    if (response_packet.identifyPacket() == RX_WARMUP_COMPLETE) {
-      Serial.printf("Bus %d: Repeller 0x%02X confirmed warmup complete\n", bus_id, repeller->address);
-    } else {
-      Serial.printf("Bus %d: Repeller 0x%02X sent unexpected warmup complete response: ", bus_id, repeller->address);
-      response_packet.print();
-    }
+  Packet packet;
+  packet.setAsTxWarmupComp(repeller->address);
+  ExpectResult result = co_await request(packet, RX_WARMUP_COMPLETE, BUS_PRIORITY_PROTOCOL);
+
+  if (result == EXPECT_MATCHED) {
+    Serial.printf("Bus %d: Repeller 0x%02X confirmed warmup complete\n", bus_id, repeller->address);
+  } else if (result == EXPECT_UNEXPECTED) {
+    Serial.printf("Bus %d: Repeller 0x%02X sent unexpected warmup complete response: ", bus_id, repeller->address);
+    last_response.print();
   } else {
     Serial.printf("Bus %d: No warmup complete response from repeller 0x%02X\n", bus_id, repeller->address);
   }
   
   // 2. send_tx_led_on_conf and look for RX_LED_ON_CONF
-  send_led_on_to_repeller(repeller);
+  co_await send_led_on_to_repeller(repeller, BUS_PRIORITY_PROTOCOL);
   
   Serial.printf("Bus %d: Activation complete for repeller 0x%02X\n", bus_id, repeller->address);
 }
 
-void Bus::retrieve_serial_for_all() {
+Task<> Bus::retrieve_serials() {
   Serial.printf("Bus %d: Retrieving serial numbers for all discovered repellers...\n", bus_id);
   
   for (auto& repeller : repellers) {
@@ -663,55 +1176,89 @@ void Bus::retrieve_serial_for_all() {
       continue;  // Skip if serial already retrieved
     } else {
       Serial.printf("Bus %d: Retrieving serial for repeller at address 0x%02X...\n", bus_id, repeller.address);
-      retrieve_serial(&repeller);
+      co_await retrieve_serial(&repeller);
     }
   }
   
   Serial.printf("Bus %d: Serial retrieval complete.\n", bus_id);
 }
 
-void Bus::warm_up_all() {
+Task<> Bus::warm_up(bool for_job) {
   Serial.printf("Bus %d: Warming up all repellers...\n", bus_id);
 
-  send_tx_powerup();  // This is the command that actually powers up the repellers
+  warm_up_phase = WARMUP_SEND_WARMUP;
+
+  {
+    BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_PROTOCOL);
+    Packet packet;
+    packet.setAsTxPowerup();
+    co_await send(packet);  // This is the command that actually powers up the repellers
+  }
 
   warm_on_at = esp_timer_get_time();  // Record the time when the repellers were turned on
   active_seconds_last_save_at = warm_on_at;  // Initialize the last save time to the warm on time
-  bus_state = BUS_WARMING_UP;
-  
+  set_state(BUS_WARMING_UP);
+
   for (auto& repeller : repellers) {
-    repeller.state = WARMING_UP;
+    set_repeller_state(repeller, WARMING_UP);
     repeller.turned_on_at = esp_timer_get_time();  // Record the time when the repeller was turned on
+    repeller.resetWarmupProgress();
+  }
+
+  // Start sampling warm-up progress once the instructions have gone out
+  next_poll_at = millis() + BUS_WARMUP_SAMPLE_INTERVAL_MS;
+
+  for (auto& repeller : repellers) {
+    if (for_job && job_cancel_requested()) {
+      break;
+    }
     Serial.printf("Bus %d: Sending warmup instruction to repeller at address 0x%02X...\n", bus_id, repeller.address);
-    send_tx_warmup(&repeller);  // Not sure entirely what this does
+    co_await send_tx_warmup(&repeller);  // Not sure entirely what this does
   }
-  
-  delay(4000);  // Wait for 4 seconds to allow warmup to start
 
+  // Wait for 4 seconds to allow warmup to start
+  warm_up_phase = WARMUP_WAIT;
+  co_await sleep_for(BUS_WARMUP_START_DELAY_MS);
+
+  warm_up_phase = WARMUP_SEND_LED_PARAMS;
+  if (for_job) {
+    set_job_progress(90);
+  }
   for (auto& repeller : repellers) {
+    if (for_job && job_cancel_requested()) {
+      break;
+    }
     Serial.printf("Bus %d: Sending LED parameters to repeller at address 0x%02X...\n", bus_id, repeller.address);
-    send_startup_led_params(&repeller);
+    co_await send_startup_led_params(&repeller);
   }
 
+  warm_up_phase = WARMUP_IDLE;
+  poll_signal.set();  // Heartbeats can start now
   Serial.printf("Bus %d: Sent warmup & initial LED instructions to all repellers.\n", bus_id);
 }
 
-void Bus::end_warm_up_all() {
+Task<> Bus::end_warm_up() {
   Serial.printf("Bus %d: Activating all repellers (ending warm up)...\n", bus_id);
 
-  send_tx_powerup();  // This is the command that actually powers up the repellers
+  {
+    BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_PROTOCOL);
+    Packet packet;
+    packet.setAsTxPowerup();
+    co_await send(packet);  // This is the command that actually powers up the repellers
+  }
   
   for (auto& repeller : repellers) {
-    repeller.state = ACTIVE;
+    set_repeller_state(repeller, ACTIVE);
     Serial.printf("Bus %d: Activating (ending warm up) repeller at address 0x%02X...\n", bus_id, repeller.address);
-    send_activate_at_end_of_warmup(&repeller);
+    co_await send_activate_at_end_of_warmup(&repeller);
   }
 
-  bus_state = BUS_REPELLING;
+  set_state(BUS_REPELLING);
+  reconcile_signal.set();  // Pick up any LED changes made during warm-up
   Serial.printf("Bus %d: Activated all repellers.\n", bus_id);
 }
 
-bool Bus::heartbeat_poll() {
+Task<bool> Bus::heartbeat() {
   // Send the heartbeat command (`send_tx_heartbeat`) to each repeller, and read the response. Update the status of each repeller based on the response.
   // If the response is RX_WARMUP, the state is WARMING_UP.
   // If the response is RX_WARMUP_COMP, the state is WARMED_UP
@@ -719,46 +1266,70 @@ bool Bus::heartbeat_poll() {
   // If no response is received, the state is OFFLINE. We'll need to add handling for this later. 
 
   Serial.printf("Bus %d: Starting heartbeat poll...\n", bus_id);
-  
+
   for (auto& repeller : repellers) {
-    Serial.printf("Bus %d: Sending heartbeat to repeller 0x%02X...\n", bus_id, repeller.address);
-    
-    // Send heartbeat command
-    send_tx_heartbeat(repeller.address);
+    if (bus_state != BUS_WARMING_UP && bus_state != BUS_REPELLING) {
+      co_return false;  // Shut down part way through the sweep
+    }
+
+    Serial.printf("Bus %d: Sending heartbeat to repeller 0x%02X...\n", bus_id, repeller.address);
     
-    // Wait for response
-    Packet response_packet;
-    if (receive_packet(response_packet, 1000)) {
-      PacketType packet_type = response_packet.identifyPacket();
+    // Send heartbeat command and wait for the response. Each repeller is a separate transaction, so
+    // higher-priority work can get onto the wire between heartbeats
+    bool received;
+    {
+      BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_BACKGROUND);
+      Packet packet;
+      packet.setAsTxHeartbeat(repeller.address);
+      co_await send(packet);
+      received = co_await receive(1000);
+    }
+
+    if (received) {
+      repeller.heartbeat_missed = false;
+      PacketType packet_type = last_response.identifyPacket();
 
       // For now, output the packet itself to the console
       Serial.printf("Bus %d: Received response from repeller 0x%02X: ", bus_id, repeller.address);
-      response_packet.print();
+      last_response.print();
       
       switch (packet_type) {
         case RX_WARMUP:
-          repeller.state = WARMING_UP;
-          Serial.printf("Bus %d: Repeller 0x%02X is warming up\n", bus_id, repeller.address);
+          set_repeller_state(repeller, WARMING_UP);
+          if (last_response.getType() == 0x01) {  // Heartbeat form carries the progress counter
+            repeller.updateWarmupProgress(last_response.getWarmupProgress(), millis());
+          }
+          Serial.printf("Bus %d: Repeller 0x%02X is warming up (progress %04X, ETA %ld ms)\n", bus_id, repeller.address,
+                        repeller.warmup_progress, repeller.warmupRemainingMs(millis()));
           break;
           
         case RX_WARMUP_COMP:
-          repeller.state = WARMED_UP;
+          set_repeller_state(repeller, WARMED_UP);
+          // Repellers on one bus can count to different values, so this is remembered per repeller
+          repeller.warmup_complete_at = last_response.getWarmupProgress();
+          repeller_ledger.set_warmup_complete_at(repeller.serial, bus_id, repeller.warmup_complete_at);
           Serial.printf("Bus %d: Repeller 0x%02X is warmed up\n", bus_id, repeller.address);
           break;
           
         case RX_HEARTBEAT_RUNNING:  // Assuming RX_HEARTBEAT_RUNNING means ACTIVE
-          repeller.state = ACTIVE;
+          set_repeller_state(repeller, ACTIVE);
           Serial.printf("Bus %d: Repeller 0x%02X is active\n", bus_id, repeller.address);
           break;
           
         default:
           Serial.printf("Bus %d: Repeller 0x%02X sent unexpected response: ", bus_id, repeller.address);
-          response_packet.print();
+          last_response.print();
           break;
       }
     } else {
-      // No response received - state remains as is for now
+      // No response received - state remains as is for now, but we can no longer vouch for its LED settings
+      repeller.clearAppliedLed();
+      reconcile_signal.set();
       Serial.printf("Bus %d: No response from repeller 0x%02X\n", bus_id, repeller.address);
+      if (!repeller.heartbeat_missed) {
+        repeller.heartbeat_missed = true;
+        emit_timeout(BUS_TIMEOUT_HEARTBEAT, repeller.address);
+      }
     }
   }
 
@@ -780,55 +1351,93 @@ bool Bus::heartbeat_poll() {
   }
 
   if(!any_warming_up && !any_warmed_up) {
-    return true;
+    co_return true;
   } else if(!any_warming_up && any_warmed_up) {
     // All repellers are warmed up and none are warming up, so we can activate them
     Serial.printf("Bus %d: All repellers warmed up, activating...\n", bus_id);
-    end_warm_up_all();
+    co_await end_warm_up();
   } else{
     Serial.printf("Bus %d: Heartbeat poll complete. Warming up: %s, Warmed up: %s\n", bus_id,
                   any_warming_up ? "true" : "false", 
                   any_warmed_up ? "true" : "false");
   }
 
-  return false; 
+  co_return false; 
 }
 
-void Bus::poll() {
-  bool heartbeat = false;  // Track if we successfully polled the heartbeat
-  unsigned long current_time = millis();
-    
-  if (current_time - last_polled > BUS_POLLING_INTERVAL_MS) {
+// Heartbeat the repellers whenever the bus is powered and its warm-up instructions have all gone out
+Task<> Bus::poll_flow() {
+  while (true) {
+    if ((bus_state != BUS_WARMING_UP && bus_state != BUS_REPELLING) || warm_up_phase != WARMUP_IDLE) {
+      co_await poll_signal.wait();
+      continue;
+    }
+
+    long wait_ms = (long)(next_poll_at - millis());
+    if (wait_ms > 0) {
+      timer_service.arm_in(poll_timer, wait_ms);
+      co_await poll_signal.wait();
+      continue;
+    }
+
     Serial.println("Sending periodic heartbeat...");
-    heartbeat = heartbeat_poll();  // Poll the heartbeat status of all repellers on the bus
-    last_polled = current_time;
+    co_await heartbeat();
+    last_polled = millis();
+    next_poll_at = millis() + next_poll_delay();
+  }
+}
+
+// While warming up, schedule the next heartbeat just ahead of the slowest repeller's estimated completion so
+// the bus starts repelling as soon as the hardware is ready, rather than up to a full polling interval later.
+unsigned long Bus::next_poll_delay() {
+  if (bus_state != BUS_WARMING_UP) {
+    return BUS_POLLING_INTERVAL_MS;
   }
 
+  long eta_ms = get_warm_up_eta_ms();
+  if (eta_ms < 0) {
+    return BUS_WARMUP_SAMPLE_INTERVAL_MS;  // Keep sampling until the progress counter gives us a rate
+  }
+
+  long delay_ms = eta_ms - BUS_WARMUP_ETA_LEAD_MS;
+  if (delay_ms < BUS_WARMUP_MIN_POLL_MS) {
+    return BUS_WARMUP_MIN_POLL_MS;
+  }
+  if (delay_ms > BUS_POLLING_INTERVAL_MS) {
+    return BUS_POLLING_INTERVAL_MS;
+  }
+  return delay_ms;
 }
 
+long Bus::get_warm_up_eta_ms() {
+  unsigned long now = millis();
+  long slowest = 0;
 
-void Bus::change_led_brightness(uint8_t brightness_pct) {
+  for (const auto& repeller : repellers) {
+    if (repeller.state != WARMING_UP) {
+      continue;
+    }
+    long remaining = repeller.warmupRemainingMs(now);
+    if (remaining < 0) {
+      return -1;  // Can't say when the bus will be done until every repeller has an estimate
+    }
+    if (remaining > slowest) {
+      slowest = remaining;
+    }
+  }
+
+  return slowest;
+}
+
+
+Task<> Bus::change_brightness(uint8_t brightness_pct) {
   // This function broadcasts the LED brightness change to all devices
   Serial.printf("Bus %d: Changing LED brightness to %d%% for all devices...\n", bus_id, brightness_pct);
 
   // 1. send_tx_led_brightness for each repeller with the specified brightness, and look for RX_LED_BRIGHTNESS
   for (auto& repeller : repellers) {
     if (repeller.state == ACTIVE) {
-      Serial.printf("Bus %d: Setting brightness to %d%% for repeller 0x%02X...\n", bus_id, brightness_pct, repeller.address);
-      send_tx_led_brightness(repeller.address, brightness_pct);
-      
-      Packet response_packet;
-      if (receive_packet(response_packet, 1000)) {
-        if (response_packet.identifyPacket() == RX_LED_BRIGHTNESS) {
-          Serial.printf("Bus %d: Repeller 0x%02X confirmed brightness change\n", bus_id, repeller.address);
-          send_led_on_to_repeller(&repeller);  // Trigger the repeller actually using the new brightness
-        } else {
-          Serial.printf("Bus %d: Repeller 0x%02X sent unexpected brightness response: ", bus_id, repeller.address);
-          response_packet.print();
-        }
-      } else {
-        Serial.printf("Bus %d: No brightness response from repeller 0x%02X\n", bus_id, repeller.address);
-      }
+      co_await set_repeller_brightness(&repeller, brightness_pct);
     } else {
       Serial.printf("Bus %d: Skipping repeller 0x%02X (not active, state: %s)\n", bus_id, repeller.address, repeller.getStateString());
     }
@@ -837,31 +1446,207 @@ void Bus::change_led_brightness(uint8_t brightness_pct) {
   Serial.printf("Bus %d: LED brightness change complete.\n", bus_id);
 }
 
-void Bus::change_led_color(uint8_t red, uint8_t green, uint8_t blue) {
+Task<bool> Bus::set_repeller_brightness(Repeller *repeller, uint8_t brightness_pct, unsigned long latency_from) {
+  Serial.printf("Bus %d: Setting brightness to %d%% for repeller 0x%02X...\n", bus_id, brightness_pct, repeller->address);
+  Packet packet;
+  packet.setAsTxLED(repeller->address, brightness_pct);
+  ExpectResult result;
+  {
+    // Like request(), but the latency sample is taken between getting the wire and sending
+    BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_INTERACTIVE);
+    if (latency_from != 0) {
+      command_latency.record(millis() - latency_from);
+    }
+    co_await send(packet);
+    result = co_await expect(RX_LED_BRIGHTNESS, 1000);
+  }
+
+  if (result == EXPECT_MATCHED) {
+    Serial.printf("Bus %d: Repeller 0x%02X confirmed brightness change\n", bus_id, repeller->address);
+    co_await send_led_on_to_repeller(repeller, BUS_PRIORITY_INTERACTIVE);  // Trigger the repeller actually using the new brightness
+    repeller->applied_brightness = brightness_pct;
+    repeller->brightness_applied = true;
+    co_return true;
+  } else if (result == EXPECT_UNEXPECTED) {
+    Serial.printf("Bus %d: Repeller 0x%02X sent unexpected brightness response: ", bus_id, repeller->address);
+    last_response.print();
+  } else {
+    Serial.printf("Bus %d: No brightness response from repeller 0x%02X\n", bus_id, repeller->address);
+  }
+  co_return false;
+}
+
+Task<> Bus::change_color(uint8_t red, uint8_t green, uint8_t blue, unsigned long latency_from) {
   // This function broadcasts the LED color change to all devices
   Serial.printf("Bus %d: Changing LED color to R:%d G:%d B:%d for all devices...\n", bus_id, red, green, blue);
 
-  // 1. Send the broadcast color command
-  send_tx_color(red, green, blue);
-  Serial.printf("Bus %d: Sent broadcast color change command\n", bus_id);
-  
-  // 2. Send the color confirmation command (AA 8E 03 08 YY ZZ ...)
-  send_tx_color_confirm(green, blue);
-  Serial.printf("Bus %d: Sent color confirmation command\n", bus_id);
+  {
+    BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_INTERACTIVE);
+    if (latency_from != 0) {
+      command_latency.record(millis() - latency_from);
+    }
+    Packet packet;
+
+    // 1. Send the broadcast color command
+    packet.setAsTxColor(red, green, blue);
+    co_await send(packet);
+    Serial.printf("Bus %d: Sent broadcast color change command\n", bus_id);
+
+    // 2. Send the color confirmation command (AA 8E 03 08 YY ZZ ...)
+    // No idea why the green and blue values are in YY and ZZ, (and the red is missing) but that's how it is
+    packet.setAsTxColorConfirm(green, blue);
+    co_await send(packet);
+    Serial.printf("Bus %d: Sent color confirmation command\n", bus_id);
+  }
+
+  // The repellers don't answer the broadcast, so assume every active repeller picked it up
+  for (auto& repeller : repellers) {
+    if (repeller.state == ACTIVE) {
+      repeller.setAppliedColor(red, green, blue);
+    }
+  }
   
   Serial.printf("Bus %d: Color change complete.\n", bus_id);
 }
 
-void Bus::shutdown_all() {
+// Converge the bus power towards the desired state. Power changes are queued as jobs (and retried after
+// BUS_POWER_RETRY_MS if they didn't take).
+void Bus::reconcile_power() {
+  if (bus_state == BUS_ERROR) {
+    return;
+  }
+
+  if (bus_state != BUS_REPELLING) {
+    // LED changes made while the bus isn't repelling are picked up by the startup parameters instead
+    color_pending = false;
+    brightness_pending = false;
+  }
+
+  bool job_pending = get_current_job().id != 0;
+  bool powered = (bus_state == BUS_WARMING_UP || bus_state == BUS_REPELLING);
+  bool retry_due = power_job_queued_at == 0 || millis() - power_job_queued_at > BUS_POWER_RETRY_MS;
+
+  if (job_pending || !retry_due) {
+    return;
+  }
+
+  if (desired_power && !powered) {
+    Serial.printf("Bus %d: Reconciler powering bus on\n", bus_id);
+    queue_job(JOB_POWER_ON);
+    power_job_queued_at = millis();
+  } else if (!desired_power && bus_state != BUS_OFFLINE) {
+    Serial.printf("Bus %d: Reconciler powering bus off\n", bus_id);
+    queue_job(JOB_POWER_OFF);
+    power_job_queued_at = millis();
+  }
+}
+
+bool Bus::color_update_ready(unsigned long now) {
+  if (bus_state != BUS_REPELLING || !desired_power || get_current_job().id != 0) {
+    return false;
+  }
+  if (color_pending && now - color_changed_at < BUS_COMMAND_DEBOUNCE_MS) {
+    return false;  // Wait for the burst to settle
+  }
+  for (const auto& repeller : repellers) {
+    if (repeller.state == ACTIVE && !repeller.colorMatches(red, green, blue)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Repeller* Bus::brightness_update_target(unsigned long now) {
+  if (bus_state != BUS_REPELLING || !desired_power || get_current_job().id != 0) {
+    return nullptr;
+  }
+  if (brightness_pending && now - brightness_changed_at < BUS_COMMAND_DEBOUNCE_MS) {
+    return nullptr;  // Wait for the burst to settle
+  }
+  uint8_t target_brightness = repeller_brightness();
+  for (auto& repeller : repellers) {
+    if (repeller.state == ACTIVE && (!repeller.brightness_applied || repeller.applied_brightness != target_brightness)) {
+      return &repeller;
+    }
+  }
+  return nullptr;
+}
+
+uint32_t Bus::reconcile_wait_ms(unsigned long now) {
+  // While a change is settling, wake up when its debounce period ends. Otherwise only the power state needs
+  // rechecking (for retries) - anything else sets reconcile_signal
+  if (color_pending && now - color_changed_at < BUS_COMMAND_DEBOUNCE_MS) {
+    return BUS_COMMAND_DEBOUNCE_MS - (now - color_changed_at);
+  }
+  if (brightness_pending && now - brightness_changed_at < BUS_COMMAND_DEBOUNCE_MS) {
+    return BUS_COMMAND_DEBOUNCE_MS - (now - brightness_changed_at);
+  }
+  return BUS_POWER_RETRY_MS;
+}
+
+// Bring the bus power and LEDs in line with the desired settings. LEDs are only touched once the bus is
+// repelling, and only on repellers whose last known settings differ from the desired ones.
+Task<> Bus::reconcile_flow() {
+  while (true) {
+    reconcile_power();
+
+    unsigned long now = millis();
+
+    // Color is a broadcast, so it goes out once if any active repeller is showing something else
+    // A command's latency is timed from the end of its debounce to when its first frame goes out, so it shows
+    // the wait for the wire (behind a heartbeat or the other bus) rather than the debounce itself
+    if (color_update_ready(now)) {
+      unsigned long latency_from = 0;
+      if (color_pending) {
+        latency_from = color_changed_at + BUS_COMMAND_DEBOUNCE_MS;
+        color_pending = false;
+      }
+      co_await change_color(red, green, blue, latency_from);
+      continue;
+    }
+
+    // Brightness is addressed, so only the repellers that differ are sent to (one at a time). If another change
+    // arrives part way through, the remaining repellers wait for it to settle and get the newer value.
+    Repeller* repeller = brightness_update_target(now);
+    if (repeller) {
+      unsigned long latency_from = 0;
+      if (brightness_pending) {
+        latency_from = brightness_changed_at + BUS_COMMAND_DEBOUNCE_MS;
+        brightness_pending = false;
+      }
+      uint8_t target_brightness = repeller_brightness();
+      if (!co_await set_repeller_brightness(repeller, target_brightness, latency_from)) {
+        // Record the attempt so an unresponsive repeller doesn't monopolise the bus - the next heartbeat
+        // will clear this again if it is still not answering
+        repeller->applied_brightness = target_brightness;
+        repeller->brightness_applied = true;
+      }
+      continue;
+    }
+
+    co_await reconcile_signal.wait(reconcile_wait_ms(now));
+  }
+}
+
+Task<> Bus::shutdown() {
   Serial.printf("Bus %d: Shutting down all repellers...\n", bus_id);
   
+  // Abandon any warm-up sequence that is still in progress
+  warm_up_phase = WARMUP_IDLE;
+
   // 1. Send send_tx_powerdown
-  send_tx_powerdown();
+  {
+    BusArbiter::Guard wire = co_await bus_arbiter.acquire(wire_id, BUS_PRIORITY_PROTOCOL);
+    Packet packet;
+    packet.setAsTxPowerdown();
+    co_await send(packet);
+  }
   Serial.printf("Bus %d: Sent powerdown command to all repellers\n", bus_id);
   
   // 2. Loop through all repellers and set their state to OFFLINE
   for (auto& repeller : repellers) {
-    repeller.state = OFFLINE;
+    set_repeller_state(repeller, OFFLINE);
+    repeller.clearAppliedLed();
     Serial.printf("Bus %d: Set repeller 0x%02X to OFFLINE state\n", bus_id, repeller.address);
   }
 
@@ -871,123 +1656,255 @@ void Bus::shutdown_all() {
   Serial.printf("Bus %d: All repellers shut down.\n", bus_id);
 }
 
-// Load settings from filesystem
+// Blocking wrappers
+void Bus::discover_repellers() {
+  executor.run_until_complete(discover());
+}
+
+void Bus::retrieve_serial_for_all() {
+  executor.run_until_complete(retrieve_serials());
+}
+
+void Bus::warm_up_all() {
+  executor.run_until_complete(warm_up());
+}
+
+void Bus::end_warm_up_all() {
+  executor.run_until_complete(end_warm_up());
+}
+
+bool Bus::heartbeat_poll() {
+  return executor.run_until_complete(heartbeat());
+}
+
+void Bus::change_led_brightness(uint8_t brightness_pct) {
+  executor.run_until_complete(change_brightness(brightness_pct));
+}
+
+void Bus::change_led_color(uint8_t red, uint8_t green, uint8_t blue) {
+  executor.run_until_complete(change_color(red, green, blue));
+}
+
+void Bus::shutdown_all() {
+  executor.run_until_complete(shutdown());
+}
+
+// Load settings from settings_store (a LittleFS file, or NVS)
 void Bus::load_settings() {
-  String filename = "/bus" + String(bus_id) + "_settings.dat";
-  
-  if (!LittleFS.exists(filename)) {
-    Serial.printf("Bus %d: Settings file not found, using defaults\n", bus_id);
+  char key[16];
+  snprintf(key, sizeof(key), "bus%d_settings", bus_id);
+
+  // The whole record in one read (see bus_settings.h)
+  uint8_t record[BUS_SETTINGS_MAX_SIZE];
+  size_t length = settings_store.read(key, record, sizeof(record), bus_settings_valid);
+  bool imported = false;
+  if (length == 0 && &settings_store != &littlefs_settings_store) {
+    // First boot on another backend - bring the settings file over
+    length = littlefs_settings_store.read(key, record, sizeof(record), bus_settings_valid);
+    imported = length > 0;
+  }
+
+  if (length == 0) {
+    Serial.printf("Bus %d: No saved settings, using defaults\n", bus_id);
     return; // Use default values set in constructor
   }
-  
-  File file = LittleFS.open(filename, "r");
-  if (!file) {
-    Serial.printf("Bus %d: Failed to open settings file, using defaults\n", bus_id);
+
+  BusSettings settings = get_settings();  // Defaults for anything an older record doesn't have
+  BusSettingsDecodeResult result = bus_settings_decode(record, length, settings);
+  if (result == BUS_SETTINGS_INVALID) {
+    Serial.printf("Bus %d: Saved settings invalid (%d bytes), using defaults\n", bus_id, length);
     return;
   }
-  
-  // Read settings in order
-  if (file.available() >= sizeof(uint8_t)) {
-    file.read((uint8_t*)&red, sizeof(uint8_t));
-  }
-  
-  if (file.available() >= sizeof(uint8_t)) {
-    file.read((uint8_t*)&green, sizeof(uint8_t));
+
+  set_settings(settings);
+  if (imported) {
+    Serial.printf("Bus %d: Settings imported from %s\n", bus_id, littlefs_settings_store.getName());
+    save_settings();
+  } else if (result == BUS_SETTINGS_MIGRATED) {
+    Serial.printf("Bus %d: Settings loaded from an older format, upgrading to version %d\n", bus_id, BUS_SETTINGS_VERSION);
+    save_settings();
+  } else {
+    Serial.printf("Bus %d: Settings loaded from %s\n", bus_id, settings_store.getName());
   }
-  
-  if (file.available() >= sizeof(uint8_t)) {
-    file.read((uint8_t*)&blue, sizeof(uint8_t));
+}
+
+BusSettings Bus::get_settings() const {
+  BusSettings settings;
+  settings.red = red;
+  settings.green = green;
+  settings.blue = blue;
+  settings.brightness = brightness;
+  settings.cartridge_active_seconds = cartridge_active_seconds;
+  settings.cartridge_warn_at_seconds = cartridge_warn_at_seconds;
+  settings.auto_shut_off_after_seconds = auto_shut_off_after_seconds;
+  return settings;
+}
+
+void Bus::set_settings(const BusSettings& settings) {
+  red = settings.red;
+  green = settings.green;
+  blue = settings.blue;
+  brightness = settings.brightness;
+  if (brightness > 254) brightness = 254; // Validate range
+  cartridge_active_seconds = settings.cartridge_active_seconds;
+  cartridge_warn_at_seconds = settings.cartridge_warn_at_seconds;
+  auto_shut_off_after_seconds = settings.auto_shut_off_after_seconds;
+  if (auto_shut_off_after_seconds > 57600) auto_shut_off_after_seconds = 18000; // Validate range
+}
+
+// Settings changes are written back by settings_timer (see bus.h)
+void Bus::mark_settings_dirty() {
+  settings_changes++;
+
+  unsigned long now = millis();
+  if (!settings_dirty) {
+    settings_dirty = true;
+    settings_dirty_since = now;
   }
-  
-  if (file.available() >= sizeof(uint8_t)) {
-    file.read((uint8_t*)&brightness, sizeof(uint8_t));
-    if (brightness > 254) brightness = 254; // Validate range
+
+  if (settings_timer == TIMER_INVALID) {
+    flush_settings();  // No worker (controller mode) to flush them later
+    return;
   }
-  
-  if (file.available() >= sizeof(uint32_t)) {
-    file.read((uint8_t*)&cartridge_active_seconds, sizeof(uint32_t));
+
+  // Push the write back with every change, but no further than BUS_SETTINGS_FLUSH_MAX_MS after the first
+  long delay_ms = BUS_SETTINGS_FLUSH_DELAY_MS;
+  long max_delay_ms = (long)(settings_dirty_since + BUS_SETTINGS_FLUSH_MAX_MS - now);
+  if (max_delay_ms < delay_ms) {
+    delay_ms = max_delay_ms > 0 ? max_delay_ms : 0;
   }
-  
-  if (file.available() >= sizeof(uint32_t)) {
-    file.read((uint8_t*)&cartridge_warn_at_seconds, sizeof(uint32_t));
+  timer_service.arm_in(settings_timer, delay_ms);
+}
+
+void Bus::flush_settings() {
+  if (!settings_dirty) {
+    return;
   }
-  
-  if (file.available() >= sizeof(uint16_t)) {
-    file.read((uint8_t*)&auto_shut_off_after_seconds, sizeof(uint16_t));
-    if (auto_shut_off_after_seconds > 57600) auto_shut_off_after_seconds = 18000; // Validate range
+  timer_service.disarm(settings_timer);
+
+  int64_t started = esp_timer_get_time();
+  save_settings();
+  settings_flush_last_us = esp_timer_get_time() - started;
+  if (settings_flush_last_us > settings_flush_max_us) {
+    settings_flush_max_us = settings_flush_last_us;
   }
-  
-  file.close();
-  Serial.printf("Bus %d: Settings loaded from filesystem\n", bus_id);
+  settings_flushes++;
+  settings_dirty = false;
 }
 
-// Save settings to filesystem
+// Save settings to settings_store, which replaces the record atomically: a reset part way through leaves
+// either the old settings or the new ones
 void Bus::save_settings() {
-  String filename = "/bus" + String(bus_id) + "_settings.dat";
-  
-  File file = LittleFS.open(filename, "w");
-  if (!file) {
-    Serial.printf("Bus %d: Failed to open settings file for writing\n", bus_id);
-    return;
+  char key[16];
+  snprintf(key, sizeof(key), "bus%d_settings", bus_id);
+
+  uint8_t record[BUS_SETTINGS_MAX_SIZE];
+  size_t length = bus_settings_encode(get_settings(), record, sizeof(record));
+  if (settings_store.write(key, record, length)) {
+    Serial.printf("Bus %d: Settings saved to %s\n", bus_id, settings_store.getName());
   }
-  
-  // Write settings in order
-  file.write((uint8_t*)&red, sizeof(uint8_t));
-  file.write((uint8_t*)&green, sizeof(uint8_t));
-  file.write((uint8_t*)&blue, sizeof(uint8_t));
-  file.write((uint8_t*)&brightness, sizeof(uint8_t));
-  file.write((uint8_t*)&cartridge_active_seconds, sizeof(uint32_t));
-  file.write((uint8_t*)&cartridge_warn_at_seconds, sizeof(uint32_t));
-  file.write((uint8_t*)&auto_shut_off_after_seconds, sizeof(uint16_t));
-  
-  file.close();
-  Serial.printf("Bus %d: Settings saved to filesystem\n", bus_id);
 }
 
 // Zigbee interface methods
 void Bus::ZigbeeSetRGB(uint8_t zb_red, uint8_t zb_green, uint8_t zb_blue) {
+  BusCommand command;
+  command.type = BUS_CMD_SET_RGB;
+  command.rgb.red = zb_red;
+  command.rgb.green = zb_green;
+  command.rgb.blue = zb_blue;
+  post(command);
+}
+
+void Bus::ZigbeeSetBrightness(uint8_t new_brightness) {
+  BusCommand command;
+  command.type = BUS_CMD_SET_BRIGHTNESS;
+  command.brightness = new_brightness;
+  post(command);
+}
+
+void Bus::ZigbeeResetCartridge() {
+  BusCommand command;
+  command.type = BUS_CMD_RESET_CARTRIDGE;
+  post(command);
+}
+
+void Bus::ZigbeeSetCartridgeWarnAtSeconds(uint32_t seconds) {
+  BusCommand command;
+  command.type = BUS_CMD_SET_WARN_AT;
+  command.warn_at_seconds = seconds;
+  post(command);
+}
+
+void Bus::ZigbeeSetAutoShutOffAfterSeconds(uint16_t seconds) {
+  BusCommand command;
+  command.type = BUS_CMD_SET_AUTO_SHUTOFF;
+  command.auto_shut_off_seconds = seconds;
+  post(command);
+}
+
+void Bus::apply_rgb(uint8_t zb_red, uint8_t zb_green, uint8_t zb_blue) {
   if(zb_red != red || zb_green != green || zb_blue != blue) {
+    color_commands++;
+    if (color_pending) {
+      color_commands_coalesced++;  // The previous value never made it to the bus
+    }
     red = zb_red;
     green = zb_green;
     blue = zb_blue;
-    save_settings();
+    color_pending = true;
+    color_changed_at = millis();
+    reconcile_signal.set();
+    mark_settings_dirty();
+    publish_setting(BUS_SETTING_COLOR);
     Serial.printf("Bus %d: RGB set to (%d, %d, %d)\n", bus_id, red, green, blue);
   } else {
     Serial.printf("Bus %d: RGB already set to (%d, %d, %d), no changes made\n", bus_id, red, green, blue);
   }
 }
 
-void Bus::ZigbeeSetBrightness(uint8_t new_brightness) {
+void Bus::apply_brightness(uint8_t new_brightness) {
   if (new_brightness > 254) {
     Serial.printf("Bus %d: Invalid brightness value %d, must be 0-254\n", bus_id, new_brightness);
     return;
   }
   if(brightness != new_brightness) {
+    brightness_commands++;
+    if (brightness_pending) {
+      brightness_commands_coalesced++;  // The previous value never made it to the bus
+    }
     brightness = new_brightness;
-    save_settings();
+    brightness_pending = true;
+    brightness_changed_at = millis();
+    reconcile_signal.set();
+    mark_settings_dirty();
+    publish_setting(BUS_SETTING_BRIGHTNESS);
     Serial.printf("Bus %d: Brightness set to %d\n", bus_id, brightness);
   } else {
     Serial.printf("Bus %d: Brightness already set to %d, no changes made", bus_id, brightness);
   }
 }
 
-void Bus::ZigbeeResetCartridge() {
+void Bus::apply_reset_cartridge() {
   cartridge_active_seconds = 0;
-  save_settings();
+  active_seconds_last_save_at = esp_timer_get_time();  // Time before the reset belonged to the old cartridge
+  runtime_journal.reset();
+  mark_settings_dirty();
+  publish_setting(BUS_SETTING_CARTRIDGE_RESET);
   Serial.printf("Bus %d: Cartridge reset, active seconds set to 0\n", bus_id);
 }
 
-void Bus::ZigbeeSetCartridgeWarnAtSeconds(uint32_t seconds) {
+void Bus::apply_warn_at_seconds(uint32_t seconds) {
   if(cartridge_warn_at_seconds != seconds) {
     cartridge_warn_at_seconds = seconds;
-    save_settings();
+    mark_settings_dirty();
+    publish_setting(BUS_SETTING_WARN_AT);
     Serial.printf("Bus %d: Cartridge warn time set to %lu seconds\n", bus_id, seconds);
   } else {
     Serial.printf("Bus %d: Cartridge warn time already set to %lu seconds, no changes made\n", bus_id, cartridge_warn_at_seconds);
   }
 }
 
-void Bus::ZigbeeSetAutoShutOffAfterSeconds(uint16_t seconds) {
+void Bus::apply_auto_shut_off_seconds(uint16_t seconds) {
   if (seconds > 57600) {
     Serial.printf("Bus %d: Invalid auto shut-off value %d, must be 0-57600\n", bus_id, seconds);
     return;
@@ -995,7 +1912,9 @@ void Bus::ZigbeeSetAutoShutOffAfterSeconds(uint16_t seconds) {
 
   if(auto_shut_off_after_seconds != seconds) {
     auto_shut_off_after_seconds = seconds;
-    save_settings();
+    mark_settings_dirty();
+    update_timers();
+    publish_setting(BUS_SETTING_AUTO_SHUTOFF);
     Serial.printf("Bus %d: Auto shut-off set to %d seconds\n", bus_id, seconds);
   } else {
     Serial.printf("Bus %d: Auto shut-off already set to %d seconds, no changes made\n", bus_id, auto_shut_off_after_seconds);
@@ -1031,10 +1950,22 @@ void Bus::save_active_seconds() {
     uint64_t current_time = esp_timer_get_time();
     uint64_t elapsed_microseconds = current_time - active_seconds_last_save_at;
     uint32_t elapsed_seconds = elapsed_microseconds / 1000000; // Convert to seconds
+    if (elapsed_seconds == 0) {
+      return;
+    }
     
-    cartridge_active_seconds += elapsed_seconds;
-    active_seconds_last_save_at = current_time;
-    save_settings();
+    runtime_journal.add(elapsed_seconds);
+    usage_history.add_active_seconds(elapsed_seconds);
+    cartridge_active_seconds = runtime_journal.getTotalSeconds();
+    active_seconds_last_save_at += (uint64_t)elapsed_seconds * 1000000;  // Carry the part second over
+
+    // Each repeller still answering ran for the same time. One without a serial yet only counts towards the bus
+    for (const auto& repeller : repellers) {
+      if (repeller.state != OFFLINE) {
+        repeller_ledger.add(repeller.serial, bus_id, elapsed_seconds);
+      }
+    }
+    repeller_ledger.flush_if_due();
     
     Serial.printf("Bus %d: Active seconds updated: %lu total\n", bus_id, cartridge_active_seconds);
   }
@@ -1056,34 +1987,275 @@ bool Bus::past_automatic_shutoff() {
   return elapsed_seconds >= auto_shut_off_after_seconds;
 }
 
-void Bus::ZigbeePowerOn() {
+// The desired state goes through the command queue like any other change, but the job itself is queued here
+// so its ID can be returned. The command is only posted once the job has been accepted, so a request turned
+// away by a full job queue leaves the desired state alone. The worker drains its commands before every run
+// of the executor, so the command is applied long before the job's bus traffic completes, and until then the
+// queued job keeps the reconciler from acting on the old desired state.
+uint16_t Bus::ZigbeePowerOn() {
   Serial.printf("Bus %d: Zigbee power on command received\n", bus_id);
-  
-  // Activate the bus if it's offline
-  if (bus_state == BUS_OFFLINE) {
-    activate();
+  uint16_t job_id = queue_job(JOB_POWER_ON);
+  if (job_id != 0) {
+    BusCommand command;
+    command.type = BUS_CMD_SET_POWER;
+    command.power.on = true;
+    command.power.job_queued = true;
+    post(command);
   }
-  
-  // If bus is just powered, then discover repellers, retrieve serial numbers, and warm up
-  if (bus_state == BUS_POWERED) {
-    discover_repellers();
-    retrieve_serial_for_all();
-    warm_up_all();
-  }
-  
-  Serial.printf("Bus %d: Zigbee power on sequence initiated\n", bus_id);
+  return job_id;
 }
 
-void Bus::ZigbeePowerOff() {
+uint16_t Bus::ZigbeePowerOff() {
   Serial.printf("Bus %d: Zigbee power off command received\n", bus_id);
-  
+  uint16_t job_id = queue_job(JOB_POWER_OFF);
+  if (job_id != 0) {
+    BusCommand command;
+    command.type = BUS_CMD_SET_POWER;
+    command.power.on = false;
+    command.power.job_queued = true;
+    post(command);
+  }
+  return job_id;
+}
+
+void Bus::set_desired_power(bool power) {
+  BusCommand command;
+  command.type = BUS_CMD_SET_POWER;
+  command.power.on = power;
+  command.power.job_queued = false;
+  post(command);
+}
+
+void Bus::apply_power(bool power, bool job_queued) {
+  if (job_queued) {
+    if (desired_power != power) {
+      publish_setting(BUS_SETTING_DESIRED_POWER);
+    }
+    desired_power = power;
+    power_job_queued_at = millis();
+  } else if (desired_power != power) {
+    desired_power = power;
+    power_job_queued_at = 0;  // Let the reconciler act on the change straight away
+    reconcile_signal.set();
+    publish_setting(BUS_SETTING_DESIRED_POWER);
+    Serial.printf("Bus %d: Desired power set to %s\n", bus_id, power ? "ON" : "OFF");
+  }
+}
+
+std::atomic<uint16_t> Bus::next_job_id(1);
+
+// Queue a power job, returning its ID (or 0 if the queue is full). A job of the same type that is already
+// waiting is reused rather than queued twice, and a power-off cancels any power-on ahead of it.
+uint16_t Bus::queue_job(BusJobType type) {
+  uint16_t id = 0;
+
+  portENTER_CRITICAL(&job_mux);
+  for (uint8_t i = 0; i < job_count; i++) {
+    BusJob& queued = job_queue[(job_head + i) % BUS_JOB_QUEUE_DEPTH];
+    if (queued.cancel_requested) {
+      continue;
+    }
+    if (queued.type == type) {
+      id = queued.id;
+    } else if (type == JOB_POWER_OFF) {
+      queued.cancel_requested = true;
+    } else {
+      id = 0;  // A power-on queued behind a power-off is a new request
+    }
+  }
+
+  if (id == 0 && job_count < BUS_JOB_QUEUE_DEPTH) {
+    BusJob& job = job_queue[(job_head + job_count) % BUS_JOB_QUEUE_DEPTH];
+    job = BusJob();
+    job.id = next_job_id++;
+    if (job.id == 0) {
+      job.id = next_job_id++;  // 0 is reserved for "no job"
+    }
+    job.type = type;
+    job.queued_at = millis();
+    job_count++;
+    id = job.id;
+  }
+  portEXIT_CRITICAL(&job_mux);
+
+  job_signal.set();
+
+  if (id == 0) {
+    Serial.printf("Bus %d: Job queue full, %s dropped\n", bus_id, type == JOB_POWER_ON ? "power on" : "power off");
+  }
+  return id;
+}
+
+BusJob Bus::get_current_job() {
+  BusJob job;
+  portENTER_CRITICAL(&job_mux);
+  if (job_count > 0) {
+    job = job_queue[job_head];
+  }
+  portEXIT_CRITICAL(&job_mux);
+  return job;
+}
+
+BusJob Bus::get_last_job() {
+  BusJob job;
+  portENTER_CRITICAL(&job_mux);
+  if (finished_count > 0) {
+    job = finished_jobs[(finished_count - 1) % BUS_JOB_HISTORY];
+  }
+  portEXIT_CRITICAL(&job_mux);
+  return job;
+}
+
+bool Bus::find_job(uint16_t id, BusJob& job) {
+  if (id == 0) {
+    return false;
+  }
+
+  bool found = false;
+  portENTER_CRITICAL(&job_mux);
+  for (uint8_t i = 0; i < job_count && !found; i++) {
+    const BusJob& queued = job_queue[(job_head + i) % BUS_JOB_QUEUE_DEPTH];
+    if (queued.id == id) {
+      job = queued;
+      found = true;
+    }
+  }
+  uint32_t kept = (finished_count < BUS_JOB_HISTORY) ? finished_count : BUS_JOB_HISTORY;
+  for (uint32_t i = finished_count - kept; i < finished_count && !found; i++) {
+    if (finished_jobs[i % BUS_JOB_HISTORY].id == id) {
+      job = finished_jobs[i % BUS_JOB_HISTORY];
+      found = true;
+    }
+  }
+  portEXIT_CRITICAL(&job_mux);
+  return found;
+}
+
+void Bus::finish_job(BusJobPhase phase) {
+  portENTER_CRITICAL(&job_mux);
+  BusJob& job = job_queue[job_head];
+  job.phase = phase;
+  job.progress = 100;
+  job.finished_at = millis();
+  job.repeller_count = repellers.size();
+  BusJob finished = job;
+  finished_jobs[finished_count % BUS_JOB_HISTORY] = job;
+  finished_count++;
+  job_head = (job_head + 1) % BUS_JOB_QUEUE_DEPTH;
+  job_count--;
+  portEXIT_CRITICAL(&job_mux);
+
+  Serial.printf("Bus %d: Job %u (%s) finished: %s\n", bus_id, finished.id, finished.getTypeString(), finished.getPhaseString());
+}
+
+// The running job (at job_head) is copied out by other tasks, so the worker updates it, and reads whether it has
+// been cancelled, under job_mux like everything else in the queue
+void Bus::update_job(BusJobPhase phase, uint8_t progress) {
+  portENTER_CRITICAL(&job_mux);
+  job_queue[job_head].phase = phase;
+  job_queue[job_head].progress = progress;
+  portEXIT_CRITICAL(&job_mux);
+}
+
+void Bus::set_job_progress(uint8_t progress) {
+  portENTER_CRITICAL(&job_mux);
+  job_queue[job_head].progress = progress;
+  portEXIT_CRITICAL(&job_mux);
+}
+
+bool Bus::job_cancel_requested() {
+  portENTER_CRITICAL(&job_mux);
+  bool cancelled = job_queue[job_head].cancel_requested;
+  portEXIT_CRITICAL(&job_mux);
+  return cancelled;
+}
+
+// Run queued power jobs one at a time. Other tasks only ever append to the queue or set cancel_requested, so
+// the running job stays at job_head until finish_job()
+Task<> Bus::job_flow() {
+  while (true) {
+    portENTER_CRITICAL(&job_mux);
+    bool have_job = job_count > 0;
+    portEXIT_CRITICAL(&job_mux);
+
+    if (!have_job) {
+      co_await job_signal.wait();
+      continue;
+    }
+
+    unsigned long started_at = millis();
+    portENTER_CRITICAL(&job_mux);
+    BusJob& job = job_queue[job_head];
+    job.started_at = started_at;
+    BusJobType type = job.type;
+    bool cancelled = job.cancel_requested;
+    portEXIT_CRITICAL(&job_mux);
+
+    BusJobPhase result;
+    if (cancelled) {
+      result = JOB_CANCELLED;
+    } else if (type == JOB_POWER_ON) {
+      result = co_await power_on();
+    } else {
+      result = co_await power_off();
+    }
+
+    finish_job(result);
+    reconcile_signal.set();
+  }
+}
+
+Task<BusJobPhase> Bus::power_on() {
+  if (bus_state == BUS_ERROR) {
+    co_return JOB_FAILED;
+  }
+  if (bus_state == BUS_WARMING_UP || bus_state == BUS_REPELLING) {
+    co_return JOB_COMPLETE;  // Already warming up or repelling
+  }
+
+  update_job(JOB_ACTIVATING, 5);
+  power_rail_on();
+  co_await power_good();
+  if (bus_state == BUS_ERROR) {
+    co_return JOB_FAILED;
+  }
+
+  if (job_cancel_requested()) {
+    co_return JOB_CANCELLED;
+  }
+  update_job(JOB_DISCOVERING, 20);
+  co_await discover();
+
+  update_job(JOB_RETRIEVING_SERIALS, 40);
+  size_t retrieved = 0;
+  for (auto& repeller : repellers) {
+    if (job_cancel_requested()) {
+      co_return JOB_CANCELLED;
+    }
+    if (strlen(repeller.serial) == 0) {
+      co_await retrieve_serial(&repeller);  // We only need to retrieve serial once
+    }
+    set_job_progress(40 + (30 * ++retrieved) / repellers.size());
+  }
+
+  if (job_cancel_requested()) {
+    co_return JOB_CANCELLED;
+  }
+  update_job(JOB_WARMING_UP, 80);
+  co_await warm_up(true);
+
+  co_return job_cancel_requested() ? JOB_CANCELLED : JOB_COMPLETE;
+}
+
+Task<BusJobPhase> Bus::power_off() {
+  update_job(JOB_SHUTTING_DOWN, 0);
+
   // Save any remaining active seconds before shutdown
   save_active_seconds();
-  
+
   // Shutdown all repellers and the bus
-  shutdown_all();
-  
-  Serial.printf("Bus %d: Zigbee power off completed\n", bus_id);
+  co_await shutdown();
+  co_return JOB_COMPLETE;
 }
 
 // Cartridge monitoring methods
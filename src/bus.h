@@ -3,10 +3,49 @@
 
 #include <Arduino.h>
 #include <list>
+#include <atomic>
 #include "packet.h"
 #include "repeller.h"
+#include "bus_job.h"
+#include "latency_stats.h"
+#include "bus_executor.h"
+#include "bus_command.h"
+#include "bus_events.h"
+#include "bus_settings.h"
+#include "runtime_journal.h"
+#include "repeller_ledger.h"
+#include "usage_history.h"
+#include "timer_service.h"
+#include "soc/soc_caps.h"
 
-#define BUS_POLLING_INTERVAL_MS 15000  // Poll every second
+#define BUS_POLLING_INTERVAL_MS 15000  // Poll every 15 seconds once repelling
+#define BUS_WARMUP_SAMPLE_INTERVAL_MS 5000  // Poll interval during warm-up until there is a completion estimate
+#define BUS_WARMUP_ETA_LEAD_MS 2000    // Poll this long before the estimated warm-up completion
+#define BUS_WARMUP_MIN_POLL_MS 1000    // Never poll more often than this during warm-up
+#define BUS_POWER_GOOD_MAX_MS 1000     // Longest we will wait for the bus to answer after raising the power pin
+#define BUS_POWER_GOOD_PROBE_MS 50     // How long each power-good probe waits for a response
+#define BUS_WARMUP_START_DELAY_MS 4000 // Time between the warmup instructions and the startup LED parameters
+#define BUS_JOB_QUEUE_DEPTH 4          // Maximum number of queued (including the running) jobs per bus
+#define BUS_JOB_HISTORY 4              // Finished jobs kept per bus, so their result can still be looked up
+#define BUS_POWER_RETRY_MS 30000       // How long the reconciler waits before retrying a power change that didn't stick
+#define BUS_COMMAND_DEBOUNCE_MS 250    // Quiet period after a color/brightness change before it is sent to the bus
+#define BUS_COMMAND_QUEUE_DEPTH 8      // Commands that can be waiting for the bus worker
+#define BUS_TASK_STACK_SIZE 8192       // Worker task stack (bytes). Flows live on the heap, so this is mostly logging
+#define BUS_TASK_PRIORITY 2            // Above loop() (1), so front-end work can't hold up a transaction
+#define BUS_SNAPSHOT_INTERVAL_MS 1000  // How often the worker refreshes its snapshot while the repellers are on
+#define BUS_CARTRIDGE_THRESHOLDS {25, 10, 0}  // Percent left at which BUS_EVENT_CARTRIDGE_THRESHOLD is published (descending)
+#define BUS_PENDING_EVENTS 8           // Events held back until the snapshot they describe has been published
+#define BUS_SNAPSHOT_REPELLERS 16      // Repellers listed in a snapshot (repeller_count still counts them all)
+#define BUS_SETTINGS_FLUSH_DELAY_MS 2000   // Quiet period after a settings change before it is written to flash
+#define BUS_SETTINGS_FLUSH_MAX_MS 10000    // Longest a change stays unwritten while further changes keep coming
+
+// Chips with a third UART give each bus its own (Serial1/Serial2), so the buses can talk at the same time.
+// Otherwise both buses share Serial1 and take turns on it.
+#if defined(SOC_UART_HP_NUM) && SOC_UART_HP_NUM > 2
+#define BUS_WIRE_COUNT 2
+#else
+#define BUS_WIRE_COUNT 1
+#endif
 
 // Bus state enumeration
 enum BusState {
@@ -17,6 +56,93 @@ enum BusState {
   BUS_ERROR
 };
 
+inline const char* bus_state_string(BusState state) {
+  switch(state) {
+    case BUS_OFFLINE: return "BUS_OFFLINE";
+    case BUS_POWERED: return "BUS_POWERED";
+    case BUS_WARMING_UP: return "BUS_WARMING_UP";
+    case BUS_REPELLING: return "BUS_REPELLING";
+    case BUS_ERROR: return "BUS_ERROR";
+    default: return "BUS_UNKNOWN";
+  }
+}
+
+// A repeller as listed in a BusSnapshot. Its cartridge runtime is in repeller_ledger, under serial
+struct RepellerSummary {
+  uint8_t address;
+  RepellerState state;
+  char serial[REPELLER_SERIAL_SIZE];  // Empty until retrieve_serial() has read it
+};
+
+// Copy of a bus's state and statistics, published by its worker task for the front ends to read
+struct BusSnapshot {
+  BusState state;
+  bool desired_power;
+  uint8_t brightness;        // 0-254 (Zigbee scale)
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t repeller_count;
+  RepellerSummary repellers[BUS_SNAPSHOT_REPELLERS];  // The first repeller_count (at most BUS_SNAPSHOT_REPELLERS)
+
+  uint32_t color_commands;
+  uint32_t color_commands_coalesced;
+  uint32_t brightness_commands;
+  uint32_t brightness_commands_coalesced;
+  uint32_t command_latency_p50_ms;
+  uint32_t command_latency_p99_ms;
+  uint8_t command_latency_samples;
+
+  long warm_up_eta_ms;       // -1 if unknown (or not warming up)
+  uint16_t last_power_up_ms;
+  uint16_t max_power_up_ms;
+  uint16_t power_up_count;
+  uint16_t power_up_timeouts;
+
+  BusJob job;                // The running job, otherwise the most recently finished one (id 0 if none)
+
+  uint16_t cartridge_runtime_hours;
+  uint8_t cartridge_percent_left;
+  uint32_t cartridge_active_seconds;
+  uint32_t cartridge_warn_at_seconds;
+  uint16_t auto_shut_off_after_seconds;
+  uint16_t runtime_journal_records;  // Records in the runtime journal since it was last compacted
+  uint32_t runtime_journal_compactions;
+  uint16_t usage_history_buckets;    // Closed hourly buckets in the usage history...
+  uint16_t usage_history_bytes;      // ...and the bytes they take (at most USAGE_HISTORY_BYTES)
+
+  uint32_t settings_changes;         // Settings changes made...
+  uint32_t settings_flushes;         // ...and the writes to flash they took
+  uint32_t settings_flush_last_us;
+  uint32_t settings_flush_max_us;
+  bool settings_dirty;               // Changes not yet written
+
+  unsigned long published_at;  // millis()
+};
+
+// Warm-up sequence phases (tracked by Bus::warm_up())
+enum WarmUpPhase {
+  WARMUP_IDLE,             // No warm-up sequence in progress
+  WARMUP_SEND_WARMUP,      // Sending tx_warmup to each repeller
+  WARMUP_WAIT,             // Waiting BUS_WARMUP_START_DELAY_MS for the repellers to start warming up
+  WARMUP_SEND_LED_PARAMS   // Sending the startup LED parameters to each repeller
+};
+
+// Priority classes for work that needs the wire. Lower values win - see BusArbiter
+enum BusPriority {
+  BUS_PRIORITY_INTERACTIVE,  // User commands (color/brightness changes)
+  BUS_PRIORITY_PROTOCOL,     // Power jobs and warm-up sequences
+  BUS_PRIORITY_BACKGROUND,   // Heartbeat polling
+  BUS_PRIORITY_NONE          // Nothing ready to run
+};
+
+// Outcome of waiting for a specific response
+enum ExpectResult {
+  EXPECT_MATCHED,     // The expected packet arrived
+  EXPECT_UNEXPECTED,  // Something else arrived (available from get_last_response())
+  EXPECT_TIMEOUT      // Nothing arrived in time
+};
+
 // Bus class to manage RS-485 bus and its connected repellers
 class Bus {
 private:
@@ -30,10 +156,152 @@ private:
   int dir_pin;
   int pow_pin;
 
+  uint8_t wire_id;         // Which BusArbiter wire (UART) this bus talks on
+  HardwareSerial* uart;
+
+  // Frame parser state (see read_packet())
+  uint8_t rx_buffer[11];
+  size_t rx_index;
+  unsigned long rx_last_byte_at;
+  bool rx_in_progress;
+
   uint64_t warm_on_at;  // Timestamp when the bus was last warmed up (for tracking auto-off settings)
   uint64_t active_seconds_last_save_at;  // Timestamp when the bus was last warmed up (for tracking auto-off settings)
 
   uint64_t last_polled;  // Timestamp at which the bus was last polled for repeller status
+  unsigned long next_poll_at;  // millis() at which the next heartbeat poll is due
+
+  unsigned long next_poll_delay();  // How long to wait before the next heartbeat poll, based on warm-up progress
+
+  WarmUpPhase warm_up_phase;  // Where warm_up() has got to
+
+  Packet last_response;  // Most recent packet received by a flow on this bus
+
+  // Worker task. Owns the bus once start() has been called: runs the flows on executor, applies queued commands
+  // and publishes snapshots. Nothing else touches the bus's state or the wire after that.
+  BusExecutor executor;
+  TaskHandle_t task;
+  QueueHandle_t command_queue;
+  BusSnapshot snapshot;       // Guarded by snapshot_mux
+  portMUX_TYPE snapshot_mux;
+
+  static void task_main(void* arg);
+  void run_worker();
+  void apply_command(const BusCommand& command);
+  void publish_snapshot();
+  void check_automatic_shutoff();
+
+  // Deadlines on timer_service (TIMER_INVALID until start()). Their callbacks only post or signal; the worker
+  // does the rest. The worker otherwise sleeps until a flow, command or one of these timers needs it.
+  TimerId shutoff_timer;   // One-shot at warm_on_at + auto_shut_off_after_seconds
+  TimerId poll_timer;      // One-shot at next_poll_at
+  TimerId refresh_timer;   // Every BUS_SNAPSHOT_INTERVAL_MS while the repellers are on (cartridge figures move)
+  TimerId runtime_timer;   // Every RUNTIME_JOURNAL_CHECKPOINT_MS while the repellers are on
+  static void on_shutoff_timer(void* arg);
+  static void on_poll_timer(void* arg);
+  static void on_refresh_timer(void* arg);
+  static void on_runtime_timer(void* arg);
+  void update_timers();    // Arm or disarm the shutoff and refresh timers to match the state and settings
+
+  // Write-back settings cache. The setters change the fields in RAM and mark them dirty; settings_timer writes
+  // them out BUS_SETTINGS_FLUSH_DELAY_MS after the last change (or BUS_SETTINGS_FLUSH_MAX_MS after the first,
+  // if they keep coming), and powerdown() writes them straight away. Without a worker they are written at once.
+  TimerId settings_timer;
+  bool settings_dirty;
+  unsigned long settings_dirty_since;  // millis() of the first change not yet written
+  uint32_t settings_changes;
+  uint32_t settings_flushes;
+  uint32_t settings_flush_last_us;     // How long the last save_settings() took
+  uint32_t settings_flush_max_us;
+  static void on_settings_timer(void* arg);
+  void mark_settings_dirty();
+  void flush_settings();
+
+  // Change notification (see BusEventHub). State changes go through these so that every transition is published.
+  // The worker holds events back until it has published a snapshot, so a subscriber reacting to one never
+  // reads a snapshot older than the event.
+  BusEvent pending_events[BUS_PENDING_EVENTS];
+  uint8_t pending_event_count;
+  void emit(BusEvent event);
+  void flush_events();
+  void set_state(BusState state);
+  void set_repeller_state(Repeller& repeller, RepellerState state);
+  void emit_timeout(BusTimeout what, uint8_t address);
+  void publish_setting(BusSetting setting);
+  void check_cartridge_thresholds();
+  uint8_t last_cartridge_percent;  // Percent left when the thresholds were last checked
+
+  void apply_rgb(uint8_t zb_red, uint8_t zb_green, uint8_t zb_blue);
+  void apply_brightness(uint8_t new_brightness);
+  void apply_reset_cartridge();
+  void apply_warn_at_seconds(uint32_t seconds);
+  void apply_auto_shut_off_seconds(uint16_t seconds);
+  void apply_power(bool power, bool job_queued);
+
+  // Wake the long-running flows started by start(). Set from any task when there may be something to do
+  BusSignal job_signal;        // A job was queued
+  BusSignal poll_signal;       // The heartbeat schedule may have changed
+  BusSignal reconcile_signal;  // The desired state may have changed
+
+  // Job queue. Jobs may be queued from other tasks (e.g. the Zigbee stack), so the queue is guarded by job_mux
+  BusJob job_queue[BUS_JOB_QUEUE_DEPTH];  // Ring buffer - the job at job_head is the one being run
+  uint8_t job_head;
+  uint8_t job_count;
+  BusJob finished_jobs[BUS_JOB_HISTORY];  // Ring - the most recently finished job is at (finished_count - 1) % size
+  uint32_t finished_count;
+  portMUX_TYPE job_mux;
+  static std::atomic<uint16_t> next_job_id;  // Shared by every bus, so an ID names one job on the whole device
+
+  // Desired state. Front ends write this (power here, LED color/brightness via the settings fields below) and
+  // reconcile_flow() converges the bus and its repellers towards it
+  bool desired_power;
+  unsigned long power_job_queued_at;  // millis() when the reconciler (or a caller) last queued a power job
+
+  // Color/brightness command coalescing. A change marks the attribute pending; the reconciler waits for
+  // BUS_COMMAND_DEBOUNCE_MS of quiet before sending, so only the latest value of a burst reaches the bus.
+  bool color_pending;
+  unsigned long color_changed_at;
+  bool brightness_pending;
+  unsigned long brightness_changed_at;
+  uint32_t color_commands;               // Color changes received
+  uint32_t color_commands_coalesced;     // ...that replaced a value which had not been sent yet
+  uint32_t brightness_commands;
+  uint32_t brightness_commands_coalesced;
+  LatencyStats command_latency;          // Time from the end of a color/brightness command's debounce to its first
+                                         // frame on the wire, so waiting for the wire counts but the fixed
+                                         // BUS_COMMAND_DEBOUNCE_MS doesn't
+
+  bool color_update_ready(unsigned long now);              // Color has settled and some active repeller differs
+  Repeller* brightness_update_target(unsigned long now);   // First active repeller needing the settled brightness
+  uint32_t reconcile_wait_ms(unsigned long now);           // How long the reconciler can sleep for
+
+  uint16_t queue_job(BusJobType type);
+  void finish_job(BusJobPhase phase);
+  void update_job(BusJobPhase phase, uint8_t progress);  // The running job's progress
+  void set_job_progress(uint8_t progress);
+  bool job_cancel_requested();
+
+  // Long-running flows, spawned by start()
+  Task<> job_flow();        // Runs queued power jobs one at a time
+  Task<> poll_flow();       // Heartbeats the repellers whenever the bus is powered
+  Task<> reconcile_flow();  // Converges power and LED settings towards the desired state
+  Task<BusJobPhase> power_on();   // Run the job at job_head
+  Task<BusJobPhase> power_off();
+
+  // Power-up latency tracking (time from raising pow_pin to the first valid frame on the bus)
+  unsigned long powered_at;   // millis() at which pow_pin was raised
+  bool power_good_pending;    // Rail is up but the bus hasn't answered (or timed out) yet
+  bool last_power_good;       // Whether the last power-up got an answer before BUS_POWER_GOOD_MAX_MS
+  uint16_t last_power_up_ms;
+  uint16_t max_power_up_ms;
+  uint16_t power_up_count;
+  uint16_t power_up_timeouts;
+
+  void attach_serial();  // Point the UART at this bus's pins if it isn't already
+  bool wait_for_power_good();  // Blocking version of power_good()
+  Task<bool> power_good();     // Probe the freshly powered bus until it answers (or BUS_POWER_GOOD_MAX_MS passes)
+  void transmit_frame(Packet *packet);  // Put a frame on the wire (without powering the bus up or pausing after)
+  bool read_packet(Packet& packet, uint16_t timeout_ms);  // Frame parser behind receive_packet()/poll_packet()
   
   // Settings fields (saved to filesystem)
   uint8_t red;                         // 0-255, default 0x03
@@ -44,6 +312,13 @@ private:
   uint32_t cartridge_warn_at_seconds;  // default 349200
   uint16_t auto_shut_off_after_seconds; // 0-57600, default 18000
 
+  // Where cartridge_active_seconds really lives. The settings record keeps a copy, used to seed the journal
+  // the first time (and otherwise ignored)
+  RuntimeJournal runtime_journal;
+
+  // Hourly active seconds, power-ons and auto shut-offs, for graphing
+  UsageHistory usage_history;
+
 public:
   // Constructor - requires bus ID (0 or 1)
   Bus(uint8_t id);
@@ -51,10 +326,15 @@ public:
   // Initialize the bus (call this in setup)
   void init();
 
-  void poll();  // Poll the bus for repeller status and update internal state if past the polling interval
+  // Spawn the job, heartbeat and reconciler flows and hand the bus over to its own worker task. From then on
+  // front ends only post commands (the setters below) and read get_snapshot()
+  void start();
+  bool post(const BusCommand& command);  // Queue a command for the worker. Returns false if the queue is full
+  BusSnapshot get_snapshot();
 
-  void activate();  // Activate the bus (Power on the bus if unpowered and set as Serial1)
+  void activate();  // Activate the bus (Power on the bus if unpowered and attach the UART)
   void powerdown();  // Power down the bus (turn off power pin if available)
+  void power_rail_on();  // Raise the power pin (if offline) without waiting for the bus to answer
   
   // Transmit packet on this bus
   void transmit(Packet *packet);
@@ -62,6 +342,16 @@ public:
   // Receive packet on this bus
   bool receive_packet(Packet& packet, uint16_t timeout_ms = 1000);
   bool receive_and_print(const char* expected_type, uint16_t timeout_ms = 500);
+  bool poll_packet(Packet& packet);  // Non-blocking - returns true if a complete packet has arrived
+
+  // Awaitable primitives for the protocol flows. The caller must hold the wire (see BusArbiter) across a
+  // send() and the receive()/expect() for its answer
+  Task<> send(Packet packet);  // Transmit, then give the bus the same settling time transmit() does
+  PacketAwaiter receive(uint16_t timeout_ms = 1000);  // Wait for the next packet (into get_last_response())
+  Task<ExpectResult> expect(PacketType type, uint16_t timeout_ms = 1000);
+  // Acquire the wire at the given priority, send the packet and wait for the expected answer
+  Task<ExpectResult> request(Packet packet, PacketType expected, BusPriority priority, uint16_t timeout_ms = 1000);
+  const Packet& get_last_response() const { return last_response; }
   
   // Individual packet transmission functions
   void send_tx_powerup();
@@ -86,42 +376,68 @@ public:
   Repeller* get_or_create_repeller(uint8_t address);
   uint8_t find_next_address();
   
-  // Helper functions for individual repeller operations
-  void retrieve_serial(Repeller* repeller);
-  void send_tx_warmup(Repeller* repeller);
-  void send_startup_led_params(Repeller* repeller);
-  void send_led_on_to_repeller(Repeller *repeller);
-  void send_activate_at_end_of_warmup(Repeller *repeller);
-
-  // Full functional transmissions
+  // Flows for individual repeller operations
+  Task<> retrieve_serial(Repeller* repeller);
+  Task<> send_tx_warmup(Repeller* repeller);
+  Task<> send_startup_led_params(Repeller* repeller);
+  Task<> send_led_on_to_repeller(Repeller *repeller, BusPriority priority);
+  Task<> send_activate_at_end_of_warmup(Repeller *repeller);
+  // Returns true if the repeller confirmed. latency_from (if not 0) is when the command became due, recorded in
+  // command_latency once the wire is ours
+  Task<bool> set_repeller_brightness(Repeller *repeller, uint8_t brightness_pct, unsigned long latency_from = 0);
+
+  // Full functional flows
   // The typical flow is:
-  // 1. Bus physically powers on (activate() is called) (can be done separately or as part of the transmit() in discover_repellers())
-  // 2. discover_repellers() is called to find all repellers
-  // 3. retrieve_serial_for_all() is called to get serial numbers for all repellers
-  // 4. warm_up_all() is called to warm up all repellers
-  // 5. end_warm_up_all() is called to activate all repellers after warmup
+  // 1. Bus physically powers on (power_rail_on() then power_good(), or activate() when blocking)
+  // 2. discover() is called to find all repellers
+  // 3. retrieve_serials() is called to get serial numbers for all repellers
+  // 4. warm_up() is called to warm up all repellers
+  // 5. end_warm_up() is called (from heartbeat()) to activate all repellers after warmup
   // 6. Repellers operate for as long as needed. Optionally, change LED brightness or color during operation
-  // 7. shutdown_all() is called to power down all repellers and the bus
+  // 7. shutdown() is called to power down all repellers and the bus
+  Task<> discover();
+  Task<> retrieve_serials();
+  Task<> warm_up(bool for_job = false);  // Run as part of the job at job_head: reports progress, stops early if it is cancelled
+  Task<> end_warm_up();
+  Task<bool> heartbeat();  // Returns true if all repellers are active, false otherwise (including during warmup)
+  Task<> change_brightness(uint8_t brightness_pct);
+  Task<> change_color(uint8_t red, uint8_t green, uint8_t blue, unsigned long latency_from = 0);  // latency_from as for set_repeller_brightness()
+  Task<> shutdown();
+  bool is_warm_up_sequence_active() const { return warm_up_phase != WARMUP_IDLE; }
+  void reconcile_power();  // Queue a power job if the bus is not in the desired power state (never touches the wire)
+
+  // Blocking versions of the above, which run the flow to completion on the bus's executor (controller mode)
   void discover_repellers();
   void retrieve_serial_for_all();
   void warm_up_all();
   void end_warm_up_all();
-  bool heartbeat_poll();  // Returns true if all repellers are active, false otherwise (including during warmup)
+  bool heartbeat_poll();
   void change_led_brightness(uint8_t brightness_pct);
   void change_led_color(uint8_t red, uint8_t green, uint8_t blue);
   void shutdown_all();
   
-  // Filesystem settings methods
+  // Saved settings methods (record format in bus_settings.h, where it is stored in settings_store.h)
   void load_settings();
   void save_settings();
+  BusSettings get_settings() const;
+  void set_settings(const BusSettings& settings);  // Clamps out-of-range values to the defaults
+
+  // Desired-state setters. Once the worker is running these post a command, otherwise they apply directly
   void ZigbeeSetRGB(uint8_t zb_red, uint8_t zb_green, uint8_t zb_blue);
   void ZigbeeSetBrightness(uint8_t brightness);
   void ZigbeeResetCartridge();
   void ZigbeeSetCartridgeWarnAtSeconds(uint32_t seconds);
   void ZigbeeSetAutoShutOffAfterSeconds(uint16_t seconds);
 
-  void ZigbeePowerOn();
-  void ZigbeePowerOff();
+  // Power on/off set the desired power state and queue a job, returning the job ID immediately (0 if the queue
+  // is full). Progress is available from get_current_job() and find_job()
+  uint16_t ZigbeePowerOn();
+  uint16_t ZigbeePowerOff();
+  void set_desired_power(bool power);  // Set the desired power state only - the reconciler queues any job needed
+  bool get_desired_power() const { return desired_power; }
+  BusJob get_current_job();  // Returns a job with id 0 if nothing is queued
+  BusJob get_last_job();
+  bool find_job(uint16_t id, BusJob& job);  // Queued, running, or one of the last BUS_JOB_HISTORY finished
   
   // Cartridge monitoring methods
   uint16_t get_cartridge_runtime_hours();
@@ -129,6 +445,27 @@ public:
   uint32_t get_cartridge_active_seconds() const { return cartridge_active_seconds; }
   uint32_t get_cartridge_warn_at_seconds() const { return cartridge_warn_at_seconds; }
   uint16_t get_auto_shut_off_after_seconds() const { return auto_shut_off_after_seconds; }
+
+  long get_warm_up_eta_ms();  // Estimated time until all repellers have warmed up, or -1 if unknown
+
+  // Usage history between two hours (Unix time / 3600), oldest first. May be called from any task
+  size_t query_usage_history(uint32_t from_hour, uint32_t to_hour, UsageBucket* out, size_t max) {
+    return usage_history.query(from_hour, to_hour, out, max);
+  }
+
+  // Command coalescing statistics
+  uint32_t get_color_commands() const { return color_commands; }
+  uint32_t get_color_commands_coalesced() const { return color_commands_coalesced; }
+  uint32_t get_brightness_commands() const { return brightness_commands; }
+  uint32_t get_brightness_commands_coalesced() const { return brightness_commands_coalesced; }
+
+  const LatencyStats& get_command_latency() const { return command_latency; }
+
+  // Power-up latency statistics
+  uint16_t get_last_power_up_ms() const { return last_power_up_ms; }
+  uint16_t get_max_power_up_ms() const { return max_power_up_ms; }
+  uint16_t get_power_up_count() const { return power_up_count; }
+  uint16_t get_power_up_timeouts() const { return power_up_timeouts; }
   
   // Helper methods for converting settings
   uint8_t repeller_brightness();
@@ -136,25 +473,17 @@ public:
   uint8_t repeller_red();
   uint8_t repeller_green();
   uint8_t repeller_blue();
-  void save_active_seconds();
+  void save_active_seconds();  // Journal the active time since the last checkpoint (and credit it to each repeller)
   bool past_automatic_shutoff();
   
   // Getters
   uint8_t getBusId() const { return bus_id; }
+  int getRxPin() const { return rx_pin; }
   BusState getState() const { return bus_state; }
   const std::list<Repeller>& getRepellers() const { return repellers; }
   
   // Method to get state as string for debugging
-  const char* getStateString() const {
-    switch(bus_state) {
-      case BUS_OFFLINE: return "BUS_OFFLINE";
-      case BUS_POWERED: return "BUS_POWERED";
-      case BUS_WARMING_UP: return "BUS_WARMING_UP";
-      case BUS_REPELLING: return "BUS_REPELLING";
-      case BUS_ERROR: return "BUS_ERROR";
-      default: return "BUS_UNKNOWN";
-    }
-  }
+  const char* getStateString() const { return bus_state_string(bus_state); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "bus_arbiter.h"
+#include "bus_executor.h"
+#include "power_manager.h"
+
+BusArbiter bus_arbiter;
+
+BusArbiter::BusArbiter() : bus_count(0) {
+  for (uint8_t i = 0; i < BUS_ARBITER_MAX_BUSES; i++) {
+    buses[i] = nullptr;
+  }
+  for (uint8_t i = 0; i < BUS_WIRE_COUNT; i++) {
+    wires[i].held = false;
+    wires[i].attached_bus_id = -1;
+  }
+  portMUX_INITIALIZE(&wire_mux);
+}
+
+void BusArbiter::add(Bus* bus) {
+  if (bus_count >= BUS_ARBITER_MAX_BUSES) {
+    Serial.printf("BusArbiter: Cannot add bus %d, already managing %d buses\n", bus->getBusId(), bus_count);
+    return;
+  }
+  buses[bus_count++] = bus;
+}
+
+BusArbiter::AcquireAwaiter BusArbiter::acquire(uint8_t wire, BusPriority priority) {
+  return AcquireAwaiter(this, wire, priority);
+}
+
+bool BusArbiter::AcquireAwaiter::try_take() {
+  portENTER_CRITICAL(&arbiter->wire_mux);
+  bool taken = !arbiter->wires[wire].held;
+  arbiter->wires[wire].held = true;
+  portEXIT_CRITICAL(&arbiter->wire_mux);
+
+  if (taken) {
+    power_manager.wire_active(wire);
+  }
+  return taken;
+}
+
+// Returns false (don't suspend) if the wire was released between await_ready() and here
+bool BusArbiter::AcquireAwaiter::enqueue(std::coroutine_handle<> handle, BusExecutor* executor) {
+  WireWaiter waiter = {priority, handle, executor};
+  std::list<WireWaiter> node;
+  node.push_back(waiter);  // Allocate outside the critical section
+
+  portENTER_CRITICAL(&arbiter->wire_mux);
+  Wire& state = arbiter->wires[wire];
+  bool suspend = state.held;
+  if (suspend) {
+    state.waiters.splice(state.waiters.end(), node);
+  } else {
+    state.held = true;
+  }
+  portEXIT_CRITICAL(&arbiter->wire_mux);
+
+  if (!suspend) {
+    power_manager.wire_active(wire);
+  }
+  return suspend;
+}
+
+void BusArbiter::release(uint8_t wire) {
+  std::list<WireWaiter> chosen_node;
+  bool freed = false;
+
+  portENTER_CRITICAL(&wire_mux);
+  Wire& state = wires[wire];
+  if (state.waiters.empty()) {
+    state.held = false;
+    freed = true;
+  } else {
+    // Hand the wire straight to the highest-priority waiter (the earliest one, if several share that priority)
+    auto chosen = state.waiters.begin();
+    for (auto it = state.waiters.begin(); it != state.waiters.end(); ++it) {
+      if (it->priority < chosen->priority) {
+        chosen = it;
+      }
+    }
+    chosen_node.splice(chosen_node.end(), state.waiters, chosen);  // Freed outside the critical section
+  }
+  portEXIT_CRITICAL(&wire_mux);
+
+  if (freed) {
+    power_manager.wire_idle(wire);  // A wire handed straight on stays active
+  }
+  if (!chosen_node.empty()) {
+    chosen_node.front().executor->schedule(chosen_node.front().handle);
+  }
+}
+
+void BusArbiter::power_on_all(uint16_t* job_ids) {
+  for (uint8_t i = 0; i < bus_count; i++) {
+    uint16_t job_id = buses[i]->ZigbeePowerOn();
+    if (job_ids) {
+      job_ids[i] = job_id;
+    }
+  }
+}
+
+void BusArbiter::power_off_all(uint16_t* job_ids) {
+  for (uint8_t i = 0; i < bus_count; i++) {
+    uint16_t job_id = buses[i]->ZigbeePowerOff();
+    if (job_ids) {
+      job_ids[i] = job_id;
+    }
+  }
+}
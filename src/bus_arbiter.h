@@ -0,0 +1,93 @@
+#ifndef BUS_ARBITER_H
+#define BUS_ARBITER_H
+
+#include <Arduino.h>
+#include <coroutine>
+#include <list>
+#include "bus.h"
+
+#define BUS_ARBITER_MAX_BUSES 2
+
+// Shares each RS-485 wire (UART) between the flows using it. A flow holds the wire (via a Guard) for a single
+// transaction; when it lets go, the wire is handed to the waiting flow with the highest priority
+// (interactive commands, then protocol flows, then background polling), so a color change never waits behind
+// a heartbeat sweep. Flows of the same priority are served in the order they asked. Where both buses share
+// Serial1 this is what keeps their worker tasks from talking over each other; with a UART per bus they only
+// ever contend with their own flows.
+class BusArbiter {
+private:
+  struct WireWaiter {
+    BusPriority priority;
+    std::coroutine_handle<> handle;
+    BusExecutor* executor;  // Where to resume it
+  };
+
+  struct Wire {
+    bool held;
+    int8_t attached_bus_id;  // Bus whose pins the UART is currently attached to (-1 if none)
+    std::list<WireWaiter> waiters;  // In the order they asked for the wire
+  };
+
+  Bus* buses[BUS_ARBITER_MAX_BUSES];
+  uint8_t bus_count;
+  Wire wires[BUS_WIRE_COUNT];
+  portMUX_TYPE wire_mux;  // Flows on different buses run in different tasks
+
+  void release(uint8_t wire);
+
+public:
+  // Holds the wire until destroyed
+  class Guard {
+  private:
+    BusArbiter* arbiter;
+    uint8_t wire;
+
+  public:
+    Guard(BusArbiter* arbiter, uint8_t wire) : arbiter(arbiter), wire(wire) {}
+    Guard(Guard&& other) noexcept : arbiter(other.arbiter), wire(other.wire) { other.arbiter = nullptr; }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    ~Guard() {
+      if (arbiter) {
+        arbiter->release(wire);
+      }
+    }
+  };
+
+  class AcquireAwaiter {
+  private:
+    BusArbiter* arbiter;
+    uint8_t wire;
+    BusPriority priority;
+
+    bool try_take();
+    bool enqueue(std::coroutine_handle<> handle, BusExecutor* executor);
+
+  public:
+    AcquireAwaiter(BusArbiter* arbiter, uint8_t wire, BusPriority priority) : arbiter(arbiter), wire(wire), priority(priority) {}
+    bool await_ready() { return try_take(); }
+    template <typename P>
+    bool await_suspend(std::coroutine_handle<P> handle) { return enqueue(handle, handle.promise().executor); }
+    Guard await_resume() { return Guard(arbiter, wire); }
+  };
+
+  BusArbiter();
+
+  void add(Bus* bus);
+  AcquireAwaiter acquire(uint8_t wire, BusPriority priority);  // co_await to get a Guard on the wire
+
+  // Which bus the wire's UART is attached to. Only changed by the holder of the wire
+  int8_t getAttachedBus(uint8_t wire) const { return wires[wire].attached_bus_id; }
+  void setAttachedBus(uint8_t wire, int8_t bus_id) { wires[wire].attached_bus_id = bus_id; }
+
+  // Power every bus on (or off) together. Each bus's worker picks up its job straight away, so the power-good,
+  // discovery and warm-up waits overlap instead of running back to back. job_ids (if given) receives one job
+  // ID per bus, in the order they were added.
+  void power_on_all(uint16_t* job_ids = nullptr);
+  void power_off_all(uint16_t* job_ids = nullptr);
+  uint8_t getBusCount() const { return bus_count; }
+};
+
+extern BusArbiter bus_arbiter;
+
+#endif
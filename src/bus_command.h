@@ -0,0 +1,39 @@
+#ifndef BUS_COMMAND_H
+#define BUS_COMMAND_H
+
+#include <Arduino.h>
+
+// Changes to a bus's desired state, posted by the front ends (HTTP handlers, Zigbee callbacks) onto the bus's
+// command queue and applied by its worker task. Power jobs have their own queue (see BusJob) so that the
+// caller can get a job ID back straight away.
+enum BusCommandType {
+  BUS_CMD_SET_RGB,
+  BUS_CMD_SET_BRIGHTNESS,
+  BUS_CMD_RESET_CARTRIDGE,
+  BUS_CMD_SET_WARN_AT,
+  BUS_CMD_SET_AUTO_SHUTOFF,
+  BUS_CMD_SET_POWER,
+  BUS_CMD_CHECK_AUTO_SHUTOFF, // Posted by the bus's auto-shutoff timer
+  BUS_CMD_FLUSH_SETTINGS,     // Posted by the bus's settings timer
+  BUS_CMD_CHECKPOINT_RUNTIME  // Posted by the bus's runtime timer
+};
+
+struct BusCommand {
+  BusCommandType type;
+  union {
+    struct {
+      uint8_t red;
+      uint8_t green;
+      uint8_t blue;
+    } rgb;
+    uint8_t brightness;               // 0-254
+    uint32_t warn_at_seconds;
+    uint16_t auto_shut_off_seconds;   // 0-57600
+    struct {
+      bool on;
+      bool job_queued;                // A power job was queued along with the command (don't let the reconciler queue another)
+    } power;
+  };
+};
+
+#endif
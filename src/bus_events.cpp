@@ -0,0 +1,192 @@
+#include "bus_events.h"
+#include "bus.h"
+#include "event_log.h"
+
+#define BUS_EVENT_LOGGER_STACK_SIZE 6144  // Prints, and appends to the flash event log (LittleFS and CRC work)
+
+BusEventHub bus_events;
+
+const char* BusEvent::getTypeString() const {
+  switch(type) {
+    case BUS_EVENT_STATE_CHANGED: return "state";
+    case BUS_EVENT_REPELLER_CHANGED: return "repeller";
+    case BUS_EVENT_SETTINGS_CHANGED: return "settings";
+    case BUS_EVENT_CARTRIDGE_THRESHOLD: return "cartridge";
+    case BUS_EVENT_AUTO_SHUTOFF: return "auto_shutoff";
+    case BUS_EVENT_DISCOVERY: return "discovery";
+    case BUS_EVENT_TIMEOUT: return "timeout";
+    default: return "unknown";
+  }
+}
+
+const char* bus_setting_string(uint8_t setting) {
+  switch(setting) {
+    case BUS_SETTING_COLOR: return "color";
+    case BUS_SETTING_BRIGHTNESS: return "brightness";
+    case BUS_SETTING_WARN_AT: return "warn_at";
+    case BUS_SETTING_AUTO_SHUTOFF: return "auto_shutoff";
+    case BUS_SETTING_CARTRIDGE_RESET: return "cartridge_reset";
+    case BUS_SETTING_DESIRED_POWER: return "desired_power";
+    default: return "unknown";
+  }
+}
+
+const char* bus_timeout_string(uint8_t what) {
+  switch(what) {
+    case BUS_TIMEOUT_POWER_UP: return "power_up";
+    case BUS_TIMEOUT_SERIAL: return "serial";
+    case BUS_TIMEOUT_HEARTBEAT: return "heartbeat";
+    default: return "unknown";
+  }
+}
+
+BusEventHub::BusEventHub() : subscriber_count(0), next_sequence(0) {
+  portMUX_INITIALIZE(&publish_mux);
+}
+
+BusEventQueue* BusEventHub::subscribe(uint32_t mask, TaskHandle_t notify) {
+  BusEventQueue* queue = nullptr;
+
+  portENTER_CRITICAL(&publish_mux);
+  if (subscriber_count < BUS_EVENT_MAX_SUBSCRIBERS) {
+    queue = &queues[subscriber_count++];
+    queue->mask = mask;
+    queue->notify = notify;
+  }
+  portEXIT_CRITICAL(&publish_mux);
+
+  if (!queue) {
+    Serial.printf("BusEventHub: Cannot subscribe, already have %d subscribers\n", BUS_EVENT_MAX_SUBSCRIBERS);
+  }
+  return queue;
+}
+
+void BusEventHub::publish(BusEvent event) {
+  TaskHandle_t to_notify[BUS_EVENT_MAX_SUBSCRIBERS];
+  uint8_t notify_count = 0;
+
+  event.at = millis();
+
+  portENTER_CRITICAL(&publish_mux);
+  event.sequence = next_sequence++;
+  for (uint8_t i = 0; i < subscriber_count; i++) {
+    BusEventQueue& queue = queues[i];
+    if (!(queue.mask & BUS_EVENT_MASK(event.type))) {
+      continue;
+    }
+    if (queue.ring.push(event)) {
+      if (queue.notify) {
+        to_notify[notify_count++] = queue.notify;
+      }
+    } else {
+      queue.dropped = queue.dropped + 1;
+      queue.overflowed = true;
+    }
+  }
+  portEXIT_CRITICAL(&publish_mux);
+
+  for (uint8_t i = 0; i < notify_count; i++) {
+    xTaskNotifyGive(to_notify[i]);
+  }
+}
+
+static BusEventQueue* logger_queue = nullptr;
+
+// Keep the events that say something went wrong (or when the bus was on) in flash_event_log. Written from the
+// logger's task so the bus workers never wait on the filesystem for it
+static void log_to_flash(const BusEvent& event) {
+  uint32_t age_ms = millis() - event.at;
+  uint8_t data[2];
+  switch (event.type) {
+    case BUS_EVENT_STATE_CHANGED:
+      data[0] = event.state.from;
+      data[1] = event.state.to;
+      flash_event_log.append(EVENT_LOG_POWER, event.bus_id, data, 2, age_ms);
+      break;
+    case BUS_EVENT_AUTO_SHUTOFF:
+      flash_event_log.append(EVENT_LOG_AUTO_SHUTOFF, event.bus_id, (const uint8_t*)&event.auto_shutoff_seconds,
+                             sizeof(event.auto_shutoff_seconds), age_ms);
+      break;
+    case BUS_EVENT_DISCOVERY:
+      flash_event_log.append(EVENT_LOG_DISCOVERY, event.bus_id, &event.found, 1, age_ms);
+      break;
+    case BUS_EVENT_TIMEOUT:
+      data[0] = event.timeout.what;
+      data[1] = event.timeout.address;
+      flash_event_log.append(EVENT_LOG_TIMEOUT, event.bus_id, data, 2, age_ms);
+      break;
+    default:
+      break;
+  }
+}
+
+void log_resync_to_flash(uint8_t source, uint32_t dropped) {
+  uint8_t data[3];
+  uint16_t count = (dropped > 0xFFFF) ? 0xFFFF : dropped;
+  data[0] = source;
+  memcpy(&data[1], &count, sizeof(count));
+  flash_event_log.append(EVENT_LOG_RESYNC, EVENT_LOG_SYSTEM, data, sizeof(data));
+}
+
+static void bus_event_logger_task(void* arg) {
+  BusEvent event;
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!logger_queue) {
+      continue;  // Woken before start_bus_event_logger() had stored the queue - the event is still in it
+    }
+
+    if (logger_queue->take_overflow()) {
+      Serial.printf("Event: %lu dropped so far\n", (unsigned long)logger_queue->getDropped());
+      log_resync_to_flash(EVENT_LOG_SOURCE_LOGGER, logger_queue->getDropped());
+    }
+    while (logger_queue->pop(event)) {
+      log_to_flash(event);
+      switch (event.type) {
+        case BUS_EVENT_STATE_CHANGED:
+          Serial.printf("Event %lu: Bus %d state %s -> %s\n", (unsigned long)event.sequence, event.bus_id,
+                        bus_state_string((BusState)event.state.from), bus_state_string((BusState)event.state.to));
+          break;
+        case BUS_EVENT_REPELLER_CHANGED:
+          Serial.printf("Event %lu: Bus %d repeller 0x%02X %s -> %s\n", (unsigned long)event.sequence, event.bus_id,
+                        event.repeller.address, repeller_state_string((RepellerState)event.repeller.from),
+                        repeller_state_string((RepellerState)event.repeller.to));
+          break;
+        case BUS_EVENT_SETTINGS_CHANGED:
+          Serial.printf("Event %lu: Bus %d %s changed\n", (unsigned long)event.sequence, event.bus_id,
+                        bus_setting_string(event.setting));
+          break;
+        case BUS_EVENT_CARTRIDGE_THRESHOLD:
+          Serial.printf("Event %lu: Bus %d cartridge at or below %d%% (%d%% left)\n", (unsigned long)event.sequence,
+                        event.bus_id, event.cartridge.threshold, event.cartridge.percent_left);
+          break;
+        case BUS_EVENT_AUTO_SHUTOFF:
+          Serial.printf("Event %lu: Bus %d auto shut-off after %d seconds\n", (unsigned long)event.sequence,
+                        event.bus_id, event.auto_shutoff_seconds);
+          break;
+        case BUS_EVENT_DISCOVERY:
+          Serial.printf("Event %lu: Bus %d discovery found %d repellers\n", (unsigned long)event.sequence,
+                        event.bus_id, event.found);
+          break;
+        case BUS_EVENT_TIMEOUT:
+          Serial.printf("Event %lu: Bus %d %s timeout (address 0x%02X)\n", (unsigned long)event.sequence,
+                        event.bus_id, bus_timeout_string(event.timeout.what), event.timeout.address);
+          break;
+      }
+    }
+  }
+}
+
+void start_bus_event_logger() {
+  TaskHandle_t task;
+  if (xTaskCreate(bus_event_logger_task, "bus_events", BUS_EVENT_LOGGER_STACK_SIZE, nullptr, 1, &task) != pdPASS) {
+    Serial.println("BusEventHub: Failed to create logger task");
+    return;
+  }
+
+  logger_queue = bus_events.subscribe(BUS_EVENT_MASK_ALL, task);
+  if (!logger_queue) {
+    vTaskDelete(task);
+  }
+}
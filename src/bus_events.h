@@ -0,0 +1,128 @@
+#ifndef BUS_EVENTS_H
+#define BUS_EVENTS_H
+
+#include <Arduino.h>
+#include "spsc_ring.h"
+
+#define BUS_EVENT_MAX_SUBSCRIBERS 4
+#define BUS_EVENT_QUEUE_DEPTH 16  // Events each subscriber can fall behind by before it has to resync
+
+enum BusEventType {
+  BUS_EVENT_STATE_CHANGED,      // The bus moved between BusStates
+  BUS_EVENT_REPELLER_CHANGED,   // A repeller was found or changed state
+  BUS_EVENT_SETTINGS_CHANGED,   // A saved setting or the desired power state changed
+  BUS_EVENT_CARTRIDGE_THRESHOLD, // The cartridge dropped to (or below) one of BUS_CARTRIDGE_THRESHOLDS
+  BUS_EVENT_AUTO_SHUTOFF,       // The bus has been on for auto_shut_off_after_seconds and is being powered off
+  BUS_EVENT_DISCOVERY,          // A discovery pass finished
+  BUS_EVENT_TIMEOUT             // The bus or a repeller didn't answer
+};
+
+// What didn't answer (BUS_EVENT_TIMEOUT)
+enum BusTimeout {
+  BUS_TIMEOUT_POWER_UP,   // The bus, within BUS_POWER_GOOD_MAX_MS of power up
+  BUS_TIMEOUT_SERIAL,     // A repeller, asked for its serial number
+  BUS_TIMEOUT_HEARTBEAT   // A repeller that had been answering heartbeats
+};
+
+#define BUS_EVENT_MASK(type) (1u << (type))
+#define BUS_EVENT_MASK_ALL 0xFFFFFFFFu
+
+enum BusSetting {
+  BUS_SETTING_COLOR,
+  BUS_SETTING_BRIGHTNESS,
+  BUS_SETTING_WARN_AT,
+  BUS_SETTING_AUTO_SHUTOFF,
+  BUS_SETTING_CARTRIDGE_RESET,
+  BUS_SETTING_DESIRED_POWER
+};
+
+// Plain values only (no Bus/Repeller headers), so events can be copied into the subscriber rings
+struct BusEvent {
+  BusEventType type;
+  uint8_t bus_id;
+  uint32_t sequence;      // Increases by one per published event, across all buses
+  unsigned long at;       // millis()
+  union {
+    struct {
+      uint8_t from;       // BusState
+      uint8_t to;
+    } state;
+    struct {
+      uint8_t address;
+      uint8_t from;       // RepellerState (OFFLINE for a newly found repeller)
+      uint8_t to;
+    } repeller;
+    uint8_t setting;      // BusSetting
+    struct {
+      uint8_t threshold;  // Percent
+      uint8_t percent_left;
+    } cartridge;
+    uint16_t auto_shutoff_seconds;  // auto_shut_off_after_seconds at the time
+    uint8_t found;        // Repellers found by the discovery pass
+    struct {
+      uint8_t what;       // BusTimeout
+      uint8_t address;    // Repeller address (0 for the bus itself)
+    } timeout;
+  };
+
+  const char* getTypeString() const;
+};
+
+const char* bus_setting_string(uint8_t setting);  // BusSetting as a string
+const char* bus_timeout_string(uint8_t what);      // BusTimeout as a string
+
+// One subscriber's bounded queue. Events that don't fit are dropped and counted; the subscriber is then told
+// (by take_overflow()) to resync from the bus snapshots instead of relying on the events it missed.
+class BusEventQueue {
+private:
+  friend class BusEventHub;
+
+  SpscRing<BusEvent, BUS_EVENT_QUEUE_DEPTH> ring;
+  uint32_t mask;
+  TaskHandle_t notify;  // Woken when an event is queued (nullptr if the subscriber polls)
+  volatile bool overflowed;
+  volatile uint32_t dropped;
+
+public:
+  BusEventQueue() : mask(0), notify(nullptr), overflowed(false), dropped(0) {}
+
+  bool pop(BusEvent& event) { return ring.pop(event); }
+  bool take_overflow() {
+    if (!overflowed) {
+      return false;
+    }
+    overflowed = false;
+    return true;
+  }
+  uint32_t getDropped() const { return dropped; }
+};
+
+// Fans events published by the bus workers out to the subscribers whose mask matches. Publishing copies the
+// event into each ring under publish_mux (there is more than one bus worker, so more than one producer);
+// subscribers pop without locking. A subscriber only sees events published after it subscribed, so it should
+// read the bus snapshots once to start from.
+class BusEventHub {
+private:
+  BusEventQueue queues[BUS_EVENT_MAX_SUBSCRIBERS];
+  uint8_t subscriber_count;
+  uint32_t next_sequence;
+  portMUX_TYPE publish_mux;
+
+public:
+  BusEventHub();
+
+  BusEventQueue* subscribe(uint32_t mask, TaskHandle_t notify = nullptr);  // nullptr if there are no free slots
+  void publish(BusEvent event);
+
+  uint32_t getPublishedCount() const { return next_sequence; }
+};
+
+extern BusEventHub bus_events;
+
+// Logs every event to Serial from a task of its own, and the ones worth keeping to flash_event_log
+void start_bus_event_logger();
+
+// Record in flash_event_log that a subscriber dropped events and had to resync (source is an EventLogSource)
+void log_resync_to_flash(uint8_t source, uint32_t dropped);
+
+#endif
@@ -0,0 +1,135 @@
+#include "bus_executor.h"
+#include "bus.h"
+
+BusExecutor::BusExecutor() : ready_head(0), ready_count(0), task(nullptr) {
+  portMUX_INITIALIZE(&ready_mux);
+}
+
+void BusExecutor::spawn(Task<> task) {
+  Task<>::Handle handle = task.release();
+  handle.promise().executor = this;
+  tasks.push_back(handle);
+  schedule(handle);
+}
+
+void BusExecutor::schedule(std::coroutine_handle<> handle) {
+  portENTER_CRITICAL(&ready_mux);
+  bool full = ready_count == BUS_EXECUTOR_MAX_READY;
+  if (!full) {
+    ready[(ready_head + ready_count) % BUS_EXECUTOR_MAX_READY] = handle;
+    ready_count++;
+  }
+  portEXIT_CRITICAL(&ready_mux);
+
+  if (full) {
+    // Every running flow has at most one coroutine waiting to resume, so this means a flow leaked
+    Serial.println("BusExecutor: Ready queue overflow");
+    abort();
+  }
+  wake();
+}
+
+void BusExecutor::wake() {
+  TaskHandle_t waiting = task;
+  if (waiting) {
+    xTaskNotifyGive(waiting);
+  }
+}
+
+void BusExecutor::wait_until(std::coroutine_handle<> handle, unsigned long wake_at) {
+  waiters.push_back({handle, wake_at, true, nullptr, nullptr, nullptr, nullptr});
+}
+
+void BusExecutor::wait_signal(std::coroutine_handle<> handle, BusSignal* signal, uint32_t timeout_ms, bool* result) {
+  waiters.push_back({handle, millis() + timeout_ms, timeout_ms != 0, signal, nullptr, nullptr, result});
+}
+
+void BusExecutor::wait_packet(std::coroutine_handle<> handle, Bus* bus, Packet* packet, unsigned long deadline, bool* result) {
+  waiters.push_back({handle, deadline, true, nullptr, bus, packet, result});
+}
+
+bool BusExecutor::run_once() {
+  unsigned long now = millis();
+
+  // Move everything whose wait is over onto the ready queue. Nothing is resumed until the scan is done, as a
+  // resumed coroutine will usually add a new waiter.
+  for (auto it = waiters.begin(); it != waiters.end();) {
+    bool arrived = false;
+    if (it->signal) {
+      arrived = it->signal->consume();
+    } else if (it->bus) {
+      arrived = it->bus->poll_packet(*it->packet);
+    }
+
+    if (arrived || (it->has_deadline && (long)(now - it->deadline) >= 0)) {
+      if (it->result) {
+        *it->result = arrived;
+      }
+      schedule(it->handle);
+      it = waiters.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  bool ran = false;
+  while (true) {
+    portENTER_CRITICAL(&ready_mux);
+    if (ready_count == 0) {
+      portEXIT_CRITICAL(&ready_mux);
+      break;
+    }
+    std::coroutine_handle<> handle = ready[ready_head];
+    ready_head = (ready_head + 1) % BUS_EXECUTOR_MAX_READY;
+    ready_count--;
+    portEXIT_CRITICAL(&ready_mux);
+
+    handle.resume();
+    ran = true;
+  }
+
+  for (auto it = tasks.begin(); it != tasks.end();) {
+    if (it->done()) {
+      it->destroy();
+      it = tasks.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  return ran;
+}
+
+void BusExecutor::wait_for_work(uint32_t max_ms) {
+  portENTER_CRITICAL(&ready_mux);
+  bool have_ready = ready_count > 0;
+  portEXIT_CRITICAL(&ready_mux);
+  if (have_ready) {
+    return;
+  }
+
+  unsigned long now = millis();
+  uint32_t wait_ms = max_ms;
+  for (const auto& waiter : waiters) {
+    if (waiter.bus || (waiter.signal && waiter.signal->isRaised())) {
+      wait_ms = 1;  // Packets are polled for, and a raised signal is picked up on the next pass
+      break;
+    }
+    if (waiter.has_deadline) {
+      long remaining = (long)(waiter.deadline - now);
+      if (remaining <= 0) {
+        return;
+      }
+      if ((uint32_t)remaining < wait_ms) {
+        wait_ms = remaining;
+      }
+    }
+  }
+
+  ulTaskNotifyTake(pdTRUE, wait_ms == BUS_EXECUTOR_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms));
+}
+
+bool PacketAwaiter::await_ready() {
+  received = bus->poll_packet(*packet);
+  return received;
+}
@@ -0,0 +1,262 @@
+#ifndef BUS_EXECUTOR_H
+#define BUS_EXECUTOR_H
+
+#include <Arduino.h>
+#include <coroutine>
+#include <list>
+
+#define BUS_EXECUTOR_MAX_READY 16  // Coroutines that can be waiting to resume at once (at most one per running flow)
+#define BUS_EXECUTOR_WAIT_FOREVER 0xFFFFFFFFu  // wait_for_work() until woken, if no flow has a deadline
+
+// Single-threaded coroutine executor for the bus protocol flows. A flow is written as straight-line code that
+// co_awaits a packet being sent, an answer arriving, a delay or another flow, and the executor resumes it
+// when that happens. Any number of flows interleave on the one task that calls run_once() (each bus has its
+// own executor, run by the bus's worker task), without hand-written state machines. Access to the wire itself
+// is arbitrated by BusArbiter.
+
+class Bus;
+class Packet;
+class BusSignal;
+class BusExecutor;
+
+template <typename T = void>
+class Task;
+
+namespace bus_task_detail {
+
+// When a task finishes, continue straight into whatever was awaiting it (if anything)
+template <typename Promise>
+struct FinalAwaiter {
+  bool await_ready() noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+    std::coroutine_handle<> continuation = handle.promise().continuation;
+    return continuation ? continuation : std::noop_coroutine();
+  }
+  void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation;
+  BusExecutor* executor = nullptr;  // Inherited from whatever awaits the task
+
+  std::suspend_always initial_suspend() noexcept { return {}; }  // Tasks only run once awaited or spawned
+  void unhandled_exception() { abort(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  T value{};
+
+  Task<T> get_return_object();
+  FinalAwaiter<Promise> final_suspend() noexcept { return {}; }
+  void return_value(T result) { value = result; }
+  T result() { return value; }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+  FinalAwaiter<Promise> final_suspend() noexcept { return {}; }
+  void return_void() {}
+  void result() {}
+};
+
+}  // namespace bus_task_detail
+
+// Return type of a protocol flow. co_await a Task to run it to completion and get its result, or hand it to
+// BusExecutor::spawn() to run it alongside everything else.
+template <typename T>
+class Task {
+public:
+  using promise_type = bus_task_detail::Promise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit Task(Handle handle) : handle(handle) {}
+  Task(Task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+  template <typename P>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<P> awaiting) noexcept {
+    handle.promise().continuation = awaiting;
+    handle.promise().executor = awaiting.promise().executor;
+    return handle;
+  }
+  T await_resume() { return handle.promise().result(); }
+
+  void bind(BusExecutor* executor) { handle.promise().executor = executor; }
+  void start() { handle.resume(); }  // Run up to the first suspension point
+  bool done() const { return handle.done(); }
+  T result() { return handle.promise().result(); }
+  Handle release() {
+    Handle released = handle;
+    handle = nullptr;
+    return released;
+  }
+
+private:
+  Handle handle;
+};
+
+namespace bus_task_detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}  // namespace bus_task_detail
+
+class BusExecutor {
+private:
+  // A suspended coroutine and what it is waiting for. Waits with a deadline also resume when it passes.
+  struct Waiter {
+    std::coroutine_handle<> handle;
+    unsigned long deadline;
+    bool has_deadline;
+    BusSignal* signal;  // Resume when this signal is set
+    Bus* bus;           // Resume when a packet arrives on this bus...
+    Packet* packet;     // ...into here
+    bool* result;       // Set to true if the signal/packet arrived, false on timeout
+  };
+
+  std::list<Waiter> waiters;
+  // Ring of coroutines ready to resume. Guarded by ready_mux, as other tasks may schedule onto it (so it is a
+  // fixed array - nothing is allocated inside the critical section)
+  std::coroutine_handle<> ready[BUS_EXECUTOR_MAX_READY];
+  uint8_t ready_head;
+  uint8_t ready_count;
+  std::list<std::coroutine_handle<>> tasks;   // Spawned top-level tasks, destroyed once they finish
+  portMUX_TYPE ready_mux;
+  TaskHandle_t task;  // Task running this executor, woken by wake() (nullptr if nothing waits on it)
+
+public:
+  BusExecutor();
+
+  void spawn(Task<> task);  // Run a flow alongside the others. The executor owns it from here on
+  void schedule(std::coroutine_handle<> handle);  // Resume on the next run_once(). Safe from any task
+
+  void wait_until(std::coroutine_handle<> handle, unsigned long wake_at);
+  void wait_signal(std::coroutine_handle<> handle, BusSignal* signal, uint32_t timeout_ms, bool* result);
+  void wait_packet(std::coroutine_handle<> handle, Bus* bus, Packet* packet, unsigned long deadline, bool* result);
+
+  bool run_once();  // Resume everything that is due. Returns true if any coroutine ran
+
+  // For a task that does nothing but run this executor: block until something may be ready (or max_ms, which
+  // may be BUS_EXECUTOR_WAIT_FOREVER)
+  void set_task(TaskHandle_t handle) { task = handle; }
+  void wait_for_work(uint32_t max_ms);
+  void wake();  // Cut wait_for_work() short. Safe from any task
+
+  // Drive the executor until the given flow completes (for the blocking wrappers in controller mode)
+  template <typename T>
+  T run_until_complete(Task<T> task) {
+    task.bind(this);
+    task.start();
+    while (!task.done()) {
+      if (!run_once()) {
+        delay(1);
+      }
+    }
+    return task.result();
+  }
+
+  size_t getTaskCount() const { return tasks.size(); }
+};
+
+// co_await sleep_for(ms) / sleep_until(millis_value)
+class SleepAwaiter {
+private:
+  unsigned long wake_at;
+
+public:
+  explicit SleepAwaiter(unsigned long wake_at) : wake_at(wake_at) {}
+  bool await_ready() const { return (long)(millis() - wake_at) >= 0; }
+  template <typename P>
+  void await_suspend(std::coroutine_handle<P> handle) { handle.promise().executor->wait_until(handle, wake_at); }
+  void await_resume() {}
+};
+
+inline SleepAwaiter sleep_for(uint32_t ms) { return SleepAwaiter(millis() + ms); }
+inline SleepAwaiter sleep_until(unsigned long wake_at) { return SleepAwaiter(wake_at); }
+
+// Wakes a flow that is waiting for something to do. set() only raises a flag and wakes the executor, so it may
+// be called from any task (e.g. the Zigbee callbacks); the executor notices it on its next pass.
+class BusSignal {
+private:
+  volatile bool raised;
+  BusExecutor* volatile executor;  // Executor of the last flow to wait on this signal
+
+public:
+  class Awaiter {
+  private:
+    BusSignal* signal;
+    uint32_t timeout_ms;
+    bool signalled;
+
+  public:
+    Awaiter(BusSignal* signal, uint32_t timeout_ms) : signal(signal), timeout_ms(timeout_ms), signalled(false) {}
+    bool await_ready() {
+      signalled = signal->consume();
+      return signalled;
+    }
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> handle) {
+      signal->executor = handle.promise().executor;
+      signal->executor->wait_signal(handle, signal, timeout_ms, &signalled);
+    }
+    bool await_resume() const { return signalled; }
+  };
+
+  BusSignal() : raised(false), executor(nullptr) {}
+
+  void set() {
+    raised = true;
+    BusExecutor* waiting = executor;
+    if (waiting) {
+      waiting->wake();
+    }
+  }
+  bool isRaised() const { return raised; }
+  bool consume() {
+    if (!raised) {
+      return false;
+    }
+    raised = false;
+    return true;
+  }
+
+  // Resumes with true once set (clearing it again), or false after timeout_ms. 0 waits indefinitely
+  Awaiter wait(uint32_t timeout_ms = 0) { return Awaiter(this, timeout_ms); }
+};
+
+// co_await for the next packet on a bus. Resumes with true once a packet was received, false on timeout.
+class PacketAwaiter {
+private:
+  Bus* bus;
+  Packet* packet;
+  unsigned long deadline;
+  bool received;
+
+public:
+  PacketAwaiter(Bus* bus, Packet* packet, uint16_t timeout_ms)
+    : bus(bus), packet(packet), deadline(millis() + timeout_ms), received(false) {}
+  bool await_ready();
+  template <typename P>
+  void await_suspend(std::coroutine_handle<P> handle) {
+    handle.promise().executor->wait_packet(handle, bus, packet, deadline, &received);
+  }
+  bool await_resume() const { return received; }
+};
+
+#endif
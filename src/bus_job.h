@@ -0,0 +1,68 @@
+#ifndef BUS_JOB_H
+#define BUS_JOB_H
+
+#include <Arduino.h>
+
+// Long-running bus operations are queued as jobs and run by the bus's worker task so that callers (HTTP handlers,
+// Zigbee callbacks) get control back immediately.
+enum BusJobType {
+  JOB_POWER_ON,
+  JOB_POWER_OFF
+};
+
+enum BusJobPhase {
+  JOB_QUEUED,
+  JOB_ACTIVATING,
+  JOB_DISCOVERING,
+  JOB_RETRIEVING_SERIALS,
+  JOB_WARMING_UP,
+  JOB_SHUTTING_DOWN,
+  JOB_COMPLETE,
+  JOB_CANCELLED,
+  JOB_FAILED
+};
+
+class BusJob {
+public:
+  uint16_t id;                 // 0 means "no job"
+  BusJobType type;
+  BusJobPhase phase;
+  uint8_t progress;            // 0-100
+  bool cancel_requested;
+  unsigned long queued_at;     // millis()
+  unsigned long started_at;    // millis(), 0 while the job is still queued
+  unsigned long finished_at;   // millis(), 0 while the job is still running
+  uint8_t repeller_count;      // Repellers on the bus when the job finished
+
+  BusJob() : id(0), type(JOB_POWER_ON), phase(JOB_QUEUED), progress(0), cancel_requested(false),
+             queued_at(0), started_at(0), finished_at(0), repeller_count(0) {}
+
+  bool isFinished() const {
+    return phase == JOB_COMPLETE || phase == JOB_CANCELLED || phase == JOB_FAILED;
+  }
+
+  const char* getTypeString() const {
+    switch(type) {
+      case JOB_POWER_ON: return "power_on";
+      case JOB_POWER_OFF: return "power_off";
+      default: return "unknown";
+    }
+  }
+
+  const char* getPhaseString() const {
+    switch(phase) {
+      case JOB_QUEUED: return "queued";
+      case JOB_ACTIVATING: return "activating";
+      case JOB_DISCOVERING: return "discovering";
+      case JOB_RETRIEVING_SERIALS: return "retrieving_serials";
+      case JOB_WARMING_UP: return "warming_up";
+      case JOB_SHUTTING_DOWN: return "shutting_down";
+      case JOB_COMPLETE: return "complete";
+      case JOB_CANCELLED: return "cancelled";
+      case JOB_FAILED: return "failed";
+      default: return "unknown";
+    }
+  }
+};
+
+#endif
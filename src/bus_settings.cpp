@@ -0,0 +1,88 @@
+#include "bus_settings.h"
+#include <esp_rom_crc.h>
+
+size_t bus_settings_encode(const BusSettings& settings, uint8_t* buffer, size_t size) {
+  BusSettingsHeader header;
+  BusSettingsPayloadV1 payload;
+  if (size < sizeof(header) + sizeof(payload)) {
+    return 0;
+  }
+
+  payload.red = settings.red;
+  payload.green = settings.green;
+  payload.blue = settings.blue;
+  payload.brightness = settings.brightness;
+  payload.cartridge_active_seconds = settings.cartridge_active_seconds;
+  payload.cartridge_warn_at_seconds = settings.cartridge_warn_at_seconds;
+  payload.auto_shut_off_after_seconds = settings.auto_shut_off_after_seconds;
+
+  header.magic = BUS_SETTINGS_MAGIC;
+  header.version = BUS_SETTINGS_VERSION;
+  header.length = sizeof(payload);
+  header.crc = esp_rom_crc32_le(0, (const uint8_t*)&payload, sizeof(payload));
+
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), &payload, sizeof(payload));
+  return sizeof(header) + sizeof(payload);
+}
+
+// The file before records were versioned: the fields in V1 order with nothing around them. Old firmware wrote
+// all of them, but read as many as were there, so do the same
+static void decode_legacy(const uint8_t* data, size_t length, BusSettingsPayloadV1& payload) {
+  memcpy(&payload, data, length < sizeof(payload) ? length : sizeof(payload));
+}
+
+BusSettingsDecodeResult bus_settings_decode(const uint8_t* data, size_t length, BusSettings& settings) {
+  BusSettingsPayloadV1 payload;
+  payload.red = settings.red;
+  payload.green = settings.green;
+  payload.blue = settings.blue;
+  payload.brightness = settings.brightness;
+  payload.cartridge_active_seconds = settings.cartridge_active_seconds;
+  payload.cartridge_warn_at_seconds = settings.cartridge_warn_at_seconds;
+  payload.auto_shut_off_after_seconds = settings.auto_shut_off_after_seconds;
+
+  BusSettingsDecodeResult result = BUS_SETTINGS_INVALID;
+  BusSettingsHeader header = {};
+  memcpy(&header, data, length < sizeof(header) ? length : sizeof(header));
+  bool versioned = length >= sizeof(header.magic) && header.magic == BUS_SETTINGS_MAGIC;
+
+  if (versioned && length >= sizeof(header) &&
+      header.length == length - sizeof(header) &&
+      header.crc == esp_rom_crc32_le(0, data + sizeof(header), header.length)) {
+    const uint8_t* body = data + sizeof(header);
+
+    // Forward migrations, oldest first. Each step brings the payload up to the next version
+    switch (header.version) {
+      case 1:
+        if (header.length >= sizeof(BusSettingsPayloadV1)) {
+          memcpy(&payload, body, sizeof(BusSettingsPayloadV1));
+          result = BUS_SETTINGS_OK;
+        }
+        break;
+      default:
+        break;  // Written by newer firmware
+    }
+  } else if (!versioned && length > 0 && length <= BUS_SETTINGS_LEGACY_SIZE) {  // A torn record still has its magic
+    decode_legacy(data, length, payload);
+    result = BUS_SETTINGS_MIGRATED;
+  }
+
+  if (result == BUS_SETTINGS_INVALID) {
+    return result;
+  }
+
+  settings.red = payload.red;
+  settings.green = payload.green;
+  settings.blue = payload.blue;
+  settings.brightness = payload.brightness;
+  settings.cartridge_active_seconds = payload.cartridge_active_seconds;
+  settings.cartridge_warn_at_seconds = payload.cartridge_warn_at_seconds;
+  settings.auto_shut_off_after_seconds = payload.auto_shut_off_after_seconds;
+  return result;
+}
+
+bool bus_settings_valid(const uint8_t* data, size_t length) {
+  BusSettings settings = {};
+  return bus_settings_decode(data, length, settings) != BUS_SETTINGS_INVALID;
+}
@@ -0,0 +1,59 @@
+#ifndef BUS_SETTINGS_H
+#define BUS_SETTINGS_H
+
+#include <Arduino.h>
+
+#define BUS_SETTINGS_MAGIC 0x54535242u  // "BRST" on flash
+#define BUS_SETTINGS_VERSION 1          // Version written by bus_settings_encode()
+#define BUS_SETTINGS_MAX_SIZE 64        // Largest record (header included) any version may take
+#define BUS_SETTINGS_LEGACY_SIZE 15     // The unversioned layout: the seven fields below, back to back
+
+// A bus's saved settings, in memory
+struct BusSettings {
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t brightness;                   // 0-254
+  uint32_t cartridge_active_seconds;
+  uint32_t cartridge_warn_at_seconds;
+  uint16_t auto_shut_off_after_seconds; // 0-57600
+};
+
+// Settings record on flash: this header, then `length` bytes of payload for `version`. The CRC32 covers the
+// payload, so a torn or partly rewritten record is rejected as a whole rather than read half old, half new.
+struct __attribute__((packed)) BusSettingsHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;
+  uint32_t crc;
+};
+
+// Payload for version 1. A new version copies this to BusSettingsPayloadV2, changes it, bumps
+// BUS_SETTINGS_VERSION and adds a step to bus_settings_decode() that migrates a V1 payload forwards.
+struct __attribute__((packed)) BusSettingsPayloadV1 {
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t brightness;
+  uint32_t cartridge_active_seconds;
+  uint32_t cartridge_warn_at_seconds;
+  uint16_t auto_shut_off_after_seconds;
+};
+
+enum BusSettingsDecodeResult {
+  BUS_SETTINGS_OK,        // Current version
+  BUS_SETTINGS_MIGRATED,  // An older version (or the legacy layout) - save again to upgrade the file
+  BUS_SETTINGS_INVALID    // Bad magic, CRC or length, or a version newer than this firmware. settings untouched
+};
+
+// Encode as the current version. Returns the record size, or 0 if buffer is smaller than that
+size_t bus_settings_encode(const BusSettings& settings, uint8_t* buffer, size_t size);
+
+// Decode a whole record (as read from flash) into settings. Fields an old record doesn't have keep the values
+// settings already held, so pass it the defaults.
+BusSettingsDecodeResult bus_settings_decode(const uint8_t* data, size_t length, BusSettings& settings);
+
+// Whether data decodes (a SettingsRecordCheck for settings_store)
+bool bus_settings_valid(const uint8_t* data, size_t length);
+
+#endif
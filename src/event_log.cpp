@@ -0,0 +1,191 @@
+#include "event_log.h"
+#include "usage_history.h"
+#include <LittleFS.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <time.h>
+
+#define EVENT_LOG_READ_RECORDS 16  // Records read per file.read() while scanning
+
+EventLog flash_event_log;
+
+const char* event_log_type_string(uint8_t type) {
+  switch(type) {
+    case EVENT_LOG_BOOT: return "boot";
+    case EVENT_LOG_POWER: return "power";
+    case EVENT_LOG_AUTO_SHUTOFF: return "auto_shutoff";
+    case EVENT_LOG_DISCOVERY: return "discovery";
+    case EVENT_LOG_TIMEOUT: return "timeout";
+    case EVENT_LOG_RESYNC: return "resync";
+    default: return "unknown";
+  }
+}
+
+uint8_t event_log_type_from_string(const char* name) {
+  for (uint8_t type = EVENT_LOG_BOOT; type <= EVENT_LOG_RESYNC; type++) {
+    if (strcmp(name, event_log_type_string(type)) == 0) {
+      return type;
+    }
+  }
+  return 0;
+}
+
+EventLog::EventLog() : lock(nullptr), next_sequence(0), record_count(0), appends(0), rotations(0) {}
+
+uint8_t EventLog::check_of(const EventRecord& record) {
+  return esp_rom_crc8_le(0, (const uint8_t*)&record, sizeof(record) - sizeof(record.check));  // check is last
+}
+
+bool EventLog::read_last(const char* path, EventRecord& record) {
+  if (!LittleFS.exists(path)) {
+    return false;
+  }
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return false;
+  }
+
+  size_t size = file.size();
+  bool found = false;
+  if (size >= sizeof(record)) {
+    file.seek(size - size % sizeof(record) - sizeof(record));
+    found = file.read((uint8_t*)&record, sizeof(record)) == sizeof(record) && record.check == check_of(record);
+  }
+  file.close();
+  return found;
+}
+
+bool EventLog::begin() {
+  if (!lock) {
+    lock = xSemaphoreCreateMutex();
+    if (!lock) {
+      Serial.println("EventLog: Failed to create lock");
+      return false;
+    }
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  EventRecord last;
+  if (read_last(EVENT_LOG_PATH, last) || read_last(EVENT_LOG_OLD_PATH, last)) {
+    next_sequence = last.sequence + 1;
+  }
+
+  size_t size = 0;
+  if (LittleFS.exists(EVENT_LOG_PATH)) {
+    File file = LittleFS.open(EVENT_LOG_PATH, "r");
+    if (file) {
+      size = file.size();
+      file.close();
+    }
+  }
+  record_count = size / sizeof(EventRecord);
+
+  // Appending after a torn record would leave everything after it misaligned
+  if (size % sizeof(EventRecord) != 0) {
+    Serial.printf("EventLog: %s ends with a partial record, starting a new file\n", EVENT_LOG_PATH);
+    rotate();
+  }
+  xSemaphoreGive(lock);
+
+  uint8_t reason = esp_reset_reason();
+  append(EVENT_LOG_BOOT, EVENT_LOG_SYSTEM, &reason, sizeof(reason));
+  Serial.printf("EventLog: Next sequence %lu\n", (unsigned long)next_sequence);
+  return true;
+}
+
+void EventLog::rotate() {
+  LittleFS.remove(EVENT_LOG_OLD_PATH);
+  if (!LittleFS.rename(EVENT_LOG_PATH, EVENT_LOG_OLD_PATH)) {
+    LittleFS.remove(EVENT_LOG_PATH);
+  }
+  record_count = 0;
+  rotations++;
+}
+
+void EventLog::append(EventLogType type, uint8_t bus_id, const uint8_t* data, size_t length, uint32_t age_ms) {
+  if (!lock) {
+    return;
+  }
+
+  EventRecord record = {};
+  record.type = type;
+  record.bus_id = bus_id;
+  memcpy(record.data, data, (length < sizeof(record.data)) ? length : sizeof(record.data));
+
+  time_t now = time(nullptr);
+  if (now >= USAGE_HISTORY_CLOCK_VALID) {
+    record.time = now - age_ms / 1000;
+  } else {
+    record.time = (millis() - age_ms) / 1000;
+    record.flags |= EVENT_LOG_UPTIME;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (record_count >= EVENT_LOG_FILE_RECORDS) {
+    rotate();
+  }
+
+  record.sequence = next_sequence;
+  record.check = check_of(record);
+
+  File file = LittleFS.open(EVENT_LOG_PATH, "a");
+  if (!file) {
+    Serial.printf("EventLog: Failed to open %s for appending\n", EVENT_LOG_PATH);
+  } else {
+    size_t written = file.write((const uint8_t*)&record, sizeof(record));
+    file.close();
+    if (written == sizeof(record)) {
+      next_sequence++;
+      record_count++;
+      appends++;
+    } else {
+      // As in begin(), a torn record would leave every later append misaligned
+      Serial.printf("EventLog: Append to %s incomplete, starting a new file\n", EVENT_LOG_PATH);
+      rotate();
+    }
+  }
+  xSemaphoreGive(lock);
+}
+
+size_t EventLog::scan(const char* path, const EventLogFilter& filter, uint32_t since, EventRecord* out,
+                      size_t count, size_t max) {
+  if (!LittleFS.exists(path)) {
+    return count;
+  }
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return count;
+  }
+
+  bool any_time = filter.from == 0 && filter.to == UINT32_MAX;
+  EventRecord records[EVENT_LOG_READ_RECORDS];
+  size_t length;
+  while (count < max && (length = file.read((uint8_t*)records, sizeof(records))) > 0) {
+    for (size_t i = 0; i < length / sizeof(EventRecord) && count < max; i++) {
+      const EventRecord& record = records[i];
+      if (record.check != check_of(record) || record.sequence < since ||
+          !(filter.type_mask & EVENT_LOG_MASK(record.type)) ||
+          (filter.bus_id != EVENT_LOG_SYSTEM && record.bus_id != filter.bus_id)) {
+        continue;
+      }
+      if ((record.flags & EVENT_LOG_UPTIME) ? !any_time : (record.time < filter.from || record.time > filter.to)) {
+        continue;
+      }
+      out[count++] = record;
+    }
+  }
+  file.close();
+  return count;
+}
+
+size_t EventLog::query(const EventLogFilter& filter, uint32_t since, EventRecord* out, size_t max) {
+  if (!lock) {
+    return 0;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  size_t count = scan(EVENT_LOG_OLD_PATH, filter, since, out, 0, max);
+  count = scan(EVENT_LOG_PATH, filter, since, out, count, max);
+  xSemaphoreGive(lock);
+  return count;
+}
@@ -0,0 +1,92 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+
+#define EVENT_LOG_PATH "/events.log"
+#define EVENT_LOG_OLD_PATH "/events.old"  // The previous file, kept until the current one fills up
+#define EVENT_LOG_FILE_RECORDS 256        // Records per file (4 KB), so the last 256-512 events are kept
+#define EVENT_LOG_SYSTEM 0xFF             // bus_id of events that aren't about a bus
+
+// Stored on flash, so new types go on the end
+enum EventLogType : uint8_t {
+  EVENT_LOG_BOOT = 1,      // data[0]: esp_reset_reason_t
+  EVENT_LOG_POWER,         // data[0], data[1]: the BusStates moved from and to
+  EVENT_LOG_AUTO_SHUTOFF,  // data[0..1]: auto_shut_off_after_seconds
+  EVENT_LOG_DISCOVERY,     // data[0]: repellers found
+  EVENT_LOG_TIMEOUT,       // data[0]: BusTimeout, data[1]: repeller address (0 for the bus itself)
+  EVENT_LOG_RESYNC         // data[0]: EventLogSource, data[1..2]: events it has dropped so far
+};
+
+#define EVENT_LOG_MASK(type) (1u << (type))
+#define EVENT_LOG_MASK_ALL 0xFFFFFFFFu
+
+// Which event subscriber fell behind (EVENT_LOG_RESYNC)
+enum EventLogSource : uint8_t {
+  EVENT_LOG_SOURCE_LOGGER,
+  EVENT_LOG_SOURCE_WIFI,
+  EVENT_LOG_SOURCE_ZIGBEE
+};
+
+#define EVENT_LOG_UPTIME 0x01  // EventRecord flag: time is seconds since boot (the clock wasn't set yet)
+
+struct __attribute__((packed)) EventRecord {
+  uint32_t sequence;  // One more than the record before it, across restarts
+  uint32_t time;      // Unix seconds (or seconds since boot, with EVENT_LOG_UPTIME)
+  uint8_t type;       // EventLogType
+  uint8_t flags;
+  uint8_t bus_id;     // EVENT_LOG_SYSTEM if not about a bus
+  uint8_t data[4];    // Depends on type
+  uint8_t check;      // CRC8 of the other fields
+};
+
+struct EventLogFilter {
+  uint32_t from;       // Unix seconds. Records timed from boot only match if from is 0 and to is UINT32_MAX
+  uint32_t to;
+  uint32_t type_mask;  // EVENT_LOG_MASK() of the types wanted
+  uint8_t bus_id;      // EVENT_LOG_SYSTEM for any
+};
+
+const char* event_log_type_string(uint8_t type);
+uint8_t event_log_type_from_string(const char* name);  // 0 if unknown
+
+// Faults and transitions kept on flash, so they can be read back without a serial console. Records are a fixed
+// 16 bytes, appended to EVENT_LOG_PATH with a single write; when that file has EVENT_LOG_FILE_RECORDS it is
+// renamed over EVENT_LOG_OLD_PATH and a new one is started, so an append never costs more than a rename and
+// the log never takes more than two files. A record torn by a reset fails its check and is skipped.
+// Everything may be called from any task.
+class EventLog {
+private:
+  SemaphoreHandle_t lock;  // Guards the files and the fields below
+  uint32_t next_sequence;
+  uint16_t record_count;   // Records in EVENT_LOG_PATH
+  uint32_t appends;
+  uint32_t rotations;
+
+  static uint8_t check_of(const EventRecord& record);
+  static bool read_last(const char* path, EventRecord& record);
+  void rotate();  // With the lock held
+  size_t scan(const char* path, const EventLogFilter& filter, uint32_t since, EventRecord* out, size_t count,
+              size_t max);
+
+public:
+  EventLog();
+
+  bool begin();  // Recover the sequence and log the reboot (call from setup, after the filesystem is mounted)
+
+  // age_ms: how long ago it happened (e.g. millis() - BusEvent::at), for events logged after the fact
+  void append(EventLogType type, uint8_t bus_id, const uint8_t* data = nullptr, size_t length = 0,
+              uint32_t age_ms = 0);
+
+  // Copy up to max records matching filter with sequence >= since into out, oldest first. Returns how many were
+  // copied; call again from the last sequence + 1 for more
+  size_t query(const EventLogFilter& filter, uint32_t since, EventRecord* out, size_t max);
+
+  uint32_t getNextSequence() const { return next_sequence; }
+  uint32_t getAppends() const { return appends; }
+  uint32_t getRotations() const { return rotations; }
+};
+
+extern EventLog flash_event_log;
+
+#endif
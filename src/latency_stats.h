@@ -0,0 +1,45 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <Arduino.h>
+#include <algorithm>
+
+#define LATENCY_STATS_SAMPLES 64  // Most recent samples kept for percentile calculation
+
+// Fixed-size window of latency samples (in milliseconds) with percentile lookup
+class LatencyStats {
+private:
+  uint32_t samples[LATENCY_STATS_SAMPLES];
+  uint8_t next_index;
+  uint8_t count;
+  uint32_t total_recorded;
+
+public:
+  LatencyStats() : next_index(0), count(0), total_recorded(0) {}
+
+  void record(uint32_t latency_ms) {
+    samples[next_index] = latency_ms;
+    next_index = (next_index + 1) % LATENCY_STATS_SAMPLES;
+    if (count < LATENCY_STATS_SAMPLES) {
+      count++;
+    }
+    total_recorded++;
+  }
+
+  // Returns the given percentile (0-100) of the samples in the window, or 0 if there are none
+  uint32_t percentile(uint8_t pct) const {
+    if (count == 0) {
+      return 0;
+    }
+    uint32_t sorted[LATENCY_STATS_SAMPLES];
+    memcpy(sorted, samples, count * sizeof(uint32_t));
+    size_t rank = ((size_t)pct * (count - 1) + 50) / 100;
+    std::nth_element(sorted, sorted + rank, sorted + count);
+    return sorted[rank];
+  }
+
+  uint8_t getCount() const { return count; }
+  uint32_t getTotalRecorded() const { return total_recorded; }
+};
+
+#endif
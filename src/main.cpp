@@ -2,6 +2,9 @@
 #include <LittleFS.h>
 #include "sniffer_mode.h"
 #include "bus.h"
+#include "bus_arbiter.h"
+#include "power_manager.h"
+#include "event_log.h"
 
 #ifdef MODE_ZIGBEE_CONTROLLER
 #include "zigbee_controller.h"
@@ -11,11 +14,16 @@
 #include "wifi_controller.h"
 #endif
 
+#ifdef MODE_BENCHMARK
+#include "benchmark_mode.h"
+#endif
+
 // Mode selection - change this to switch between modes
 // #define MODE_SNIFFER 0
 // #define MODE_CONTROLLER 1
 // #define MODE_ZIGBEE_CONTROLLER 2
 // #define MODE_WIFI_CONTROLLER 3
+// #define MODE_BENCHMARK 4
 
 // Set the desired mode here
 // #define CURRENT_MODE       MODE_WIFI_CONTROLLER
@@ -35,6 +43,16 @@ void setup() {
   } else {
     Serial.println("LittleFS initialized successfully");
   }
+
+  // Persistent event log. Records this boot (and the reset reason) first
+  flash_event_log.begin();
+
+  // Frequency scaling and light sleep (does nothing unless built with -D POWER_MANAGEMENT)
+  const int bus_rx_pins[] = {bus0.getRxPin(), bus1.getRxPin()};
+  power_manager.begin(bus_rx_pins, 2);
+
+  // Per-repeller cartridge runtime, shared by both buses
+  repeller_ledger.begin();
   
 #ifdef MODE_SNIFFER
   Serial.println("Starting in SNIFFER mode...");
@@ -75,9 +93,15 @@ void setup() {
 
   delay(1000);
 
+  start_bus_event_logger();
+
   // Initialize both buses for Zigbee control
   bus0.init();
   bus1.init();
+  bus_arbiter.add(&bus0);
+  bus_arbiter.add(&bus1);
+  bus0.start();
+  bus1.start();
 
   // Initialize Zigbee controller
   zigbee_controller_setup();
@@ -96,6 +120,11 @@ void setup() {
   
   Serial.println("WiFi controller initialization completed!");
 #endif
+
+#ifdef MODE_BENCHMARK
+  Serial.println("Starting in BENCHMARK mode...");
+  benchmark_setup();
+#endif
 }
 
 bool ran_once = false;
@@ -138,13 +167,14 @@ void loop() {
 #endif
 
 #ifdef MODE_ZIGBEE_CONTROLLER
-    zigbee_controller_loop();
-    delay(100);
+    zigbee_controller_loop();  // Blocks until a bus publishes a change
 #endif
 
 #ifdef MODE_WIFI_CONTROLLER
-    wifi_controller_loop();
-    yield();
-    // delay(100);
+    wifi_controller_loop();  // Blocks until there is something to do (see wifi_controller_loop())
+#endif
+
+#ifdef MODE_BENCHMARK
+    benchmark_loop();
 #endif
 }
\ No newline at end of file
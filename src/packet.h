@@ -79,6 +79,13 @@ public:
     return data[2];
   }
   
+  // Get the warm-up progress counter (XX YY) from an RX_WARMUP heartbeat response or RX_WARMUP_COMP
+  // RX Warming Up: AA 80 01 02 XX YY 00 00 00 00 00
+  // RX Warmup Complete : AA 80 01 05 XX YY 00 00 00 00 00
+  uint16_t getWarmupProgress() const {
+    return (data[4] << 8) | data[5];
+  }
+  
   // Get raw data pointer for compatibility
   const uint8_t* getRawData() const {
     return data;
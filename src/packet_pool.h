@@ -0,0 +1,64 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <Arduino.h>
+#include "packet.h"
+#include "spsc_ring.h"
+
+// A received (or about to be sent) frame with where and when it was seen
+struct PooledPacket {
+  Packet packet;
+  uint64_t timestamp_us;  // esp_timer_get_time() when the frame completed
+  uint8_t bus_id;
+};
+
+// Fixed set of PooledPackets for passing frames between one producer and one consumer without allocating.
+// The producer acquire()s a slot, fills it in and passes the pointer on (through an SpscRing<PooledPacket*>,
+// for instance); the consumer release()s it when done. The free list is itself an SpscRing running the other
+// way, so the same single-producer/single-consumer rules apply and neither side locks.
+template <size_t Capacity>
+class PacketPool {
+  static_assert(Capacity <= 65536, "PacketPool slots are indexed by uint16_t");
+
+private:
+  PooledPacket slots[Capacity];
+  SpscRing<uint16_t, Capacity> free_slots;
+
+public:
+  PacketPool() {
+    for (size_t i = 0; i < Capacity; i++) {
+      free_slots.push(i);
+    }
+  }
+  PacketPool(const PacketPool&) = delete;
+  PacketPool& operator=(const PacketPool&) = delete;
+
+  // Producer side. Returns nullptr if every slot is in use
+  PooledPacket* acquire() {
+    uint16_t index;
+    if (!free_slots.pop(index)) {
+      return nullptr;
+    }
+    return &slots[index];
+  }
+
+  PooledPacket* acquire(const uint8_t* data, uint8_t bus_id) {
+    PooledPacket* slot = acquire();
+    if (slot) {
+      slot->packet.setData(data);
+      slot->timestamp_us = esp_timer_get_time();
+      slot->bus_id = bus_id;
+    }
+    return slot;
+  }
+
+  // Consumer side
+  void release(PooledPacket* slot) {
+    free_slots.push(slot - slots);
+  }
+
+  size_t available() const { return free_slots.size(); }
+  static constexpr size_t capacity() { return Capacity; }
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "power_manager.h"
+
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE)
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_sleep.h>
+#endif
+
+PowerManager power_manager;
+
+PowerManager::PowerManager() : enabled(false), light_sleep(false), bus_active_us(0), bus_transactions(0),
+                               asleep_us(0), sleep_count(0) {
+  for (uint8_t i = 0; i < BUS_WIRE_COUNT; i++) {
+    wire_active_since[i] = 0;
+  }
+  portMUX_INITIALIZE(&stats_mux);
+}
+
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE) && defined(CONFIG_PM_LIGHT_SLEEP_CALLBACKS)
+// Runs on the way out of light sleep, with interrupts still off
+static esp_err_t IRAM_ATTR on_light_sleep_exit(int64_t sleep_time_us, void* arg) {
+  static_cast<PowerManager*>(arg)->record_sleep(sleep_time_us);
+  return ESP_OK;
+}
+#endif
+
+void PowerManager::begin(const int* rx_pins, uint8_t pin_count) {
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE)
+  esp_pm_config_t config = {};
+  config.max_freq_mhz = POWER_MAX_CPU_FREQ_MHZ;
+  config.min_freq_mhz = POWER_MIN_CPU_FREQ_MHZ;
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  config.light_sleep_enable = true;
+#endif
+
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    Serial.printf("PowerManager: esp_pm_configure failed: %s\n", esp_err_to_name(err));
+    return;
+  }
+
+  for (uint8_t i = 0; i < BUS_WIRE_COUNT; i++) {
+    char name[12];
+    snprintf(name, sizeof(name), "wire%d", i);
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, name, &wire_cpu_lock[i]) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, name, &wire_sleep_lock[i]) != ESP_OK) {
+      Serial.printf("PowerManager: Failed to create locks for wire %d\n", i);
+      return;
+    }
+  }
+
+  enabled = true;
+  light_sleep = config.light_sleep_enable;
+
+  if (light_sleep) {
+    configure_wake_sources(rx_pins, pin_count);
+#ifdef CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    esp_pm_sleep_cbs_register_config_t callbacks = {};
+    callbacks.exit_cb = on_light_sleep_exit;
+    callbacks.exit_cb_user_arg = this;
+    esp_pm_light_sleep_register_cbs(&callbacks);
+#endif
+  }
+
+  Serial.printf("PowerManager: DFS %d-%d MHz, light sleep %s\n", POWER_MIN_CPU_FREQ_MHZ, POWER_MAX_CPU_FREQ_MHZ,
+                light_sleep ? "on" : "off (needs CONFIG_FREERTOS_USE_TICKLESS_IDLE)");
+#elif defined(POWER_MANAGEMENT)
+  Serial.println("PowerManager: POWER_MANAGEMENT set, but the framework was built without CONFIG_PM_ENABLE");
+#endif
+}
+
+// A repeller only talks when spoken to, and the wire is held (so the chip kept awake) for the whole exchange.
+// The wake sources are for everything else: a falling edge on a bus RX pin, and the console UART.
+void PowerManager::configure_wake_sources(const int* rx_pins, uint8_t pin_count) {
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE)
+  for (uint8_t i = 0; i < pin_count; i++) {
+    if (rx_pins[i] < 0) {
+      continue;
+    }
+    gpio_wakeup_enable((gpio_num_t)rx_pins[i], GPIO_INTR_LOW_LEVEL);  // RS-485 idles high; a start bit is low
+  }
+  esp_sleep_enable_gpio_wakeup();
+
+#if defined(CONFIG_ESP_CONSOLE_UART_NUM) && CONFIG_ESP_CONSOLE_UART_NUM >= 0
+  uart_set_wakeup_threshold((uart_port_t)CONFIG_ESP_CONSOLE_UART_NUM, 3);
+  esp_sleep_enable_uart_wakeup(CONFIG_ESP_CONSOLE_UART_NUM);
+#endif
+#endif
+}
+
+void PowerManager::wire_active(uint8_t wire) {
+  if (!enabled) {
+    return;
+  }
+
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE)
+  esp_pm_lock_acquire(wire_cpu_lock[wire]);
+  esp_pm_lock_acquire(wire_sleep_lock[wire]);
+#endif
+
+  portENTER_CRITICAL(&stats_mux);
+  wire_active_since[wire] = esp_timer_get_time();
+  bus_transactions = bus_transactions + 1;
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+void PowerManager::wire_idle(uint8_t wire) {
+  if (!enabled) {
+    return;
+  }
+
+  portENTER_CRITICAL(&stats_mux);
+  if (wire_active_since[wire]) {
+    bus_active_us = bus_active_us + (esp_timer_get_time() - wire_active_since[wire]);
+    wire_active_since[wire] = 0;
+  }
+  portEXIT_CRITICAL(&stats_mux);
+
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE)
+  esp_pm_lock_release(wire_sleep_lock[wire]);
+  esp_pm_lock_release(wire_cpu_lock[wire]);
+#endif
+}
+
+void IRAM_ATTR PowerManager::record_sleep(int64_t slept_us) {
+  asleep_us = asleep_us + slept_us;
+  sleep_count = sleep_count + 1;
+}
+
+PowerStats PowerManager::getStats() {
+  PowerStats stats;
+  stats.enabled = enabled;
+  stats.light_sleep = light_sleep;
+  stats.max_freq_mhz = enabled ? POWER_MAX_CPU_FREQ_MHZ : getCpuFrequencyMhz();
+  stats.min_freq_mhz = enabled ? POWER_MIN_CPU_FREQ_MHZ : getCpuFrequencyMhz();
+  stats.current_freq_mhz = getCpuFrequencyMhz();
+  stats.uptime_us = esp_timer_get_time();
+
+  portENTER_CRITICAL(&stats_mux);
+  stats.bus_active_us = bus_active_us;
+  for (uint8_t i = 0; i < BUS_WIRE_COUNT; i++) {
+    if (wire_active_since[i]) {
+      stats.bus_active_us += stats.uptime_us - wire_active_since[i];  // Include the transaction in flight
+    }
+  }
+  stats.bus_transactions = bus_transactions;
+  portEXIT_CRITICAL(&stats_mux);
+
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE) && defined(CONFIG_PM_LIGHT_SLEEP_CALLBACKS)
+  stats.asleep_us = light_sleep ? (int64_t)asleep_us : 0;
+  stats.sleep_count = sleep_count;
+#else
+  stats.asleep_us = light_sleep ? -1 : 0;
+  stats.sleep_count = 0;
+#endif
+  return stats;
+}
@@ -0,0 +1,66 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include "bus.h"
+
+#ifdef POWER_MANAGEMENT
+#include <esp_pm.h>
+#endif
+
+// Build with -D POWER_MANAGEMENT to let the chip scale its clock down and light-sleep while nothing needs it.
+// Needs CONFIG_PM_ENABLE in the framework's sdkconfig (and CONFIG_FREERTOS_USE_TICKLESS_IDLE for light sleep);
+// without them begin() says so and everything here is a no-op.
+#define POWER_MAX_CPU_FREQ_MHZ 160
+#define POWER_MIN_CPU_FREQ_MHZ 40   // The crystal frequency - the lowest DFS will go
+
+struct PowerStats {
+  bool enabled;                 // DFS is configured
+  bool light_sleep;             // ...and so is automatic light sleep
+  uint16_t max_freq_mhz;
+  uint16_t min_freq_mhz;
+  uint16_t current_freq_mhz;
+  uint64_t uptime_us;
+  uint64_t bus_active_us;       // Time some wire was in a transaction (so held at full clock, awake)
+  uint32_t bus_transactions;
+  int64_t asleep_us;            // Time in light sleep (-1 if the framework can't report it)
+  uint32_t sleep_count;
+};
+
+// Owns the esp_pm configuration and the locks the buses take while they use the wire. BusArbiter calls
+// wire_active() when a wire goes from free to held and wire_idle() when it is free again, so a lock is held for
+// exactly as long as a transaction is in flight (handing the wire straight to another flow doesn't drop it).
+// The bus UART RX pins are also set up as light-sleep wake sources.
+class PowerManager {
+private:
+  bool enabled;
+  bool light_sleep;
+  uint64_t wire_active_since[BUS_WIRE_COUNT];  // esp_timer_get_time() when the wire was taken (0 if free)
+  volatile uint64_t bus_active_us;
+  volatile uint32_t bus_transactions;
+  volatile uint64_t asleep_us;
+  volatile uint32_t sleep_count;
+  portMUX_TYPE stats_mux;
+#if defined(POWER_MANAGEMENT) && defined(CONFIG_PM_ENABLE)
+  esp_pm_lock_handle_t wire_cpu_lock[BUS_WIRE_COUNT];    // ESP_PM_CPU_FREQ_MAX
+  esp_pm_lock_handle_t wire_sleep_lock[BUS_WIRE_COUNT];  // ESP_PM_NO_LIGHT_SLEEP (the UART must stay clocked)
+#endif
+
+  void configure_wake_sources(const int* rx_pins, uint8_t pin_count);
+
+public:
+  PowerManager();
+
+  // Call once from setup(), with the RX pins of the buses in use
+  void begin(const int* rx_pins, uint8_t pin_count);
+
+  void wire_active(uint8_t wire);
+  void wire_idle(uint8_t wire);
+  void record_sleep(int64_t slept_us);  // From the light-sleep exit callback
+
+  PowerStats getStats();
+};
+
+extern PowerManager power_manager;
+
+#endif
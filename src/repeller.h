@@ -4,6 +4,8 @@
 #include <Arduino.h>
 #include <list>
 
+#define REPELLER_SERIAL_SIZE 17  // The two 8-character halves read by Bus::retrieve_serial(), and a NUL
+
 // Repeller state enumeration
 enum RepellerState {
   OFFLINE,
@@ -13,18 +15,106 @@ enum RepellerState {
   ACTIVE
 };
 
+inline const char* repeller_state_string(RepellerState state) {
+  switch(state) {
+    case OFFLINE: return "OFFLINE";
+    case INACTIVE: return "INACTIVE";
+    case WARMING_UP: return "WARMING_UP";
+    case WARMED_UP: return "WARMED_UP";
+    case ACTIVE: return "ACTIVE";
+    default: return "UNKNOWN";
+  }
+}
+
 // Repeller class to manage individual repeller devices
 class Repeller {
 public:
   uint8_t address;
-  char serial[16];
+  char serial[REPELLER_SERIAL_SIZE];
   RepellerState state;
   uint64_t turned_on_at;
+  bool heartbeat_missed;             // The last heartbeat went unanswered (a run of misses is reported once)
+
+  // Warm-up progress, decoded from the XX YY bytes of RX_WARMUP heartbeat responses
+  uint16_t warmup_progress;          // Last reported progress counter
+  unsigned long warmup_progress_at;  // millis() at which the counter last changed (0 if never reported)
+  uint32_t warmup_eta_ms;            // Estimated time until warm-up completes, measured from warmup_progress_at (0 if unknown)
+  uint16_t warmup_complete_at;       // Counter value this repeller last reported in RX_WARMUP_COMP (0 if not seen).
+                                     // Kept in the repeller ledger, so it is known from the first warm-up after a boot
+
+  // LED settings the repeller is known to be using (confirmed by the repeller, or broadcast while it was active).
+  // The bus reconciler compares these against the desired settings and only sends to repellers that differ.
+  bool brightness_applied;
+  uint8_t applied_brightness;        // 0-100 (repeller scale)
+  bool color_applied;
+  uint8_t applied_red;
+  uint8_t applied_green;
+  uint8_t applied_blue;
   
   // Constructor - requires address, initializes serial to blank and state to inactive
-  Repeller(uint8_t addr) : address(addr), state(INACTIVE) {
+  Repeller(uint8_t addr) : address(addr), state(INACTIVE), turned_on_at(0), heartbeat_missed(false),
+                           warmup_progress(0), warmup_progress_at(0), warmup_eta_ms(0), warmup_complete_at(0),
+                           brightness_applied(false), applied_brightness(0),
+                           color_applied(false), applied_red(0), applied_green(0), applied_blue(0) {
     serial[0] = '\0';  // Initialize serial as empty string
   }
+
+  // Record a new warm-up progress sample and re-estimate the time remaining from the rate of change.
+  // The counter's direction isn't known for certain, so a falling counter is assumed to finish at 0 and a
+  // rising one at warmup_complete_at (with no estimate if that isn't known yet).
+  void updateWarmupProgress(uint16_t progress, unsigned long now) {
+    if (warmup_progress_at != 0 && progress == warmup_progress) {
+      return;  // Keep the time of the last change so the next rate covers the whole step
+    }
+
+    if (warmup_progress_at != 0) {
+      uint32_t elapsed_ms = now - warmup_progress_at;
+      uint32_t step = (progress > warmup_progress) ? progress - warmup_progress : warmup_progress - progress;
+      uint32_t remaining = 0;
+      if (progress < warmup_progress) {
+        remaining = progress;
+      } else if (warmup_complete_at > progress) {
+        remaining = warmup_complete_at - progress;
+      }
+      warmup_eta_ms = (remaining > 0) ? (uint32_t)(((uint64_t)remaining * elapsed_ms) / step) : 0;
+    }
+
+    warmup_progress = progress;
+    warmup_progress_at = now;
+  }
+
+  // Reset warm-up tracking (called when a new warm-up starts)
+  void resetWarmupProgress() {
+    warmup_progress = 0;
+    warmup_progress_at = 0;
+    warmup_eta_ms = 0;
+  }
+
+  // Forget what the LEDs are showing (e.g. the repeller stopped answering or was powered down)
+  void clearAppliedLed() {
+    brightness_applied = false;
+    color_applied = false;
+  }
+
+  bool colorMatches(uint8_t red, uint8_t green, uint8_t blue) const {
+    return color_applied && applied_red == red && applied_green == green && applied_blue == blue;
+  }
+
+  void setAppliedColor(uint8_t red, uint8_t green, uint8_t blue) {
+    applied_red = red;
+    applied_green = green;
+    applied_blue = blue;
+    color_applied = true;
+  }
+
+  // Milliseconds until warm-up is expected to complete, or -1 if there is no estimate yet
+  long warmupRemainingMs(unsigned long now) const {
+    if (warmup_eta_ms == 0) {
+      return -1;
+    }
+    long remaining = (long)warmup_eta_ms - (long)(now - warmup_progress_at);
+    return remaining > 0 ? remaining : 0;
+  }
   
   // Method to set serial number from two parts
   void setSerial(const char* part1, const char* part2) {
@@ -32,16 +122,7 @@ public:
   }
   
   // Method to get state as string for debugging
-  const char* getStateString() const {
-    switch(state) {
-      case OFFLINE: return "OFFLINE";
-      case INACTIVE: return "INACTIVE";
-      case WARMING_UP: return "WARMING_UP";
-      case WARMED_UP: return "WARMED_UP";
-      case ACTIVE: return "ACTIVE";
-      default: return "UNKNOWN";
-    }
-  }
+  const char* getStateString() const { return repeller_state_string(state); }
 };
 
 
@@ -0,0 +1,251 @@
+#include "repeller_ledger.h"
+#include "settings_store.h"
+#include <esp_rom_crc.h>
+
+RepellerLedger repeller_ledger;
+
+static size_t image_size(uint16_t count) {
+  return sizeof(RepellerLedgerHeader) + count * sizeof(RepellerLedgerEntry);
+}
+
+bool repeller_ledger_valid(const uint8_t* data, size_t length) {
+  if (length < sizeof(RepellerLedgerHeader)) {
+    return false;
+  }
+
+  RepellerLedgerHeader header;
+  memcpy(&header, data, sizeof(header));
+  return header.magic == REPELLER_LEDGER_MAGIC && header.version == REPELLER_LEDGER_VERSION &&
+         header.count <= REPELLER_LEDGER_MAX_ENTRIES && length == image_size(header.count) &&
+         header.crc == esp_rom_crc32_le(0, data + sizeof(header), length - sizeof(header));
+}
+
+RepellerLedger::RepellerLedger() : lock(nullptr), dirty(false), flushed_at(0), flushes(0), seen_counter(0), evictions(0) {
+  image.header.magic = REPELLER_LEDGER_MAGIC;
+  image.header.version = REPELLER_LEDGER_VERSION;
+  image.header.count = 0;
+  image.header.crc = 0;
+}
+
+bool RepellerLedger::begin() {
+  if (!lock) {
+    lock = xSemaphoreCreateMutex();
+    if (!lock) {
+      Serial.println("RepellerLedger: Failed to create lock");
+      return false;
+    }
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  size_t length = settings_store.read(REPELLER_LEDGER_KEY, (uint8_t*)&image, sizeof(image), repeller_ledger_valid);
+  if (length > 0 && !repeller_ledger_valid((const uint8_t*)&image, length)) {
+    Serial.println("RepellerLedger: Saved index is invalid, starting a new one");
+    length = 0;
+  }
+  if (length == 0) {
+    image.header.magic = REPELLER_LEDGER_MAGIC;
+    image.header.version = REPELLER_LEDGER_VERSION;
+    image.header.count = 0;
+  }
+  seen_counter = 0;
+  for (uint16_t i = 0; i < image.header.count; i++) {
+    if (image.entries[i].last_seen > seen_counter) {
+      seen_counter = image.entries[i].last_seen;
+    }
+  }
+  flushed_at = millis();
+  Serial.printf("RepellerLedger: %d repellers\n", image.header.count);
+  xSemaphoreGive(lock);
+  return true;
+}
+
+int RepellerLedger::find(const char* serial, bool& found) const {
+  int low = 0;
+  int high = image.header.count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    int order = strncmp(image.entries[middle].serial, serial, REPELLER_SERIAL_SIZE);
+    if (order == 0) {
+      found = true;
+      return middle;
+    }
+    if (order < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  found = false;
+  return low;
+}
+
+RepellerLedgerEntry* RepellerLedger::find_or_insert(const char* serial) {
+  bool found;
+  int index = find(serial, found);
+  if (found) {
+    return &image.entries[index];
+  }
+
+  uint16_t count = image.header.count;
+  if (count >= REPELLER_LEDGER_MAX_ENTRIES) {
+    int oldest = 0;
+    for (int i = 1; i < count; i++) {
+      if (image.entries[i].last_seen < image.entries[oldest].last_seen) {
+        oldest = i;
+      }
+    }
+    Serial.printf("RepellerLedger: Index full, forgetting %s (%lu active seconds) for %s\n",
+                  image.entries[oldest].serial, (unsigned long)image.entries[oldest].active_seconds, serial);
+    memmove(&image.entries[oldest], &image.entries[oldest + 1], (count - oldest - 1) * sizeof(RepellerLedgerEntry));
+    count--;
+    image.header.count = count;
+    evictions++;
+    index = find(serial, found);
+  }
+
+  memmove(&image.entries[index + 1], &image.entries[index], (count - index) * sizeof(RepellerLedgerEntry));
+  RepellerLedgerEntry& entry = image.entries[index];
+  memset(&entry, 0, sizeof(entry));
+  strncpy(entry.serial, serial, REPELLER_SERIAL_SIZE - 1);
+  entry.last_seen = ++seen_counter;
+  image.header.count = count + 1;
+  dirty = true;
+  return &entry;
+}
+
+void RepellerLedger::touch(const char* serial, uint8_t bus_id) {
+  if (!lock || serial[0] == '\0') {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  RepellerLedgerEntry* entry = find_or_insert(serial);
+  if (entry) {
+    entry->last_bus = bus_id;
+    entry->last_seen = ++seen_counter;
+    dirty = true;
+  }
+  xSemaphoreGive(lock);
+}
+
+void RepellerLedger::add(const char* serial, uint8_t bus_id, uint32_t seconds) {
+  if (!lock || serial[0] == '\0' || seconds == 0) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  RepellerLedgerEntry* entry = find_or_insert(serial);
+  if (entry) {
+    entry->active_seconds += seconds;
+    entry->last_bus = bus_id;
+    entry->last_seen = ++seen_counter;
+    dirty = true;
+  }
+  xSemaphoreGive(lock);
+}
+
+void RepellerLedger::set_warmup_complete_at(const char* serial, uint8_t bus_id, uint16_t value) {
+  if (!lock || serial[0] == '\0') {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  RepellerLedgerEntry* entry = find_or_insert(serial);
+  if (entry && (entry->warmup_complete_at != value || entry->last_bus != bus_id)) {
+    entry->warmup_complete_at = value;
+    entry->last_bus = bus_id;
+    dirty = true;
+  }
+  xSemaphoreGive(lock);
+}
+
+bool RepellerLedger::reset(const char* serial) {
+  if (!lock) {
+    return false;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool found;
+  int index = find(serial, found);
+  if (found) {
+    image.entries[index].active_seconds = 0;
+    dirty = true;
+    write();
+  }
+  xSemaphoreGive(lock);
+  return found;
+}
+
+bool RepellerLedger::lookup(const char* serial, RepellerLedgerEntry& entry) {
+  if (!lock || serial[0] == '\0') {
+    return false;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool found;
+  int index = find(serial, found);
+  if (found) {
+    entry = image.entries[index];
+  }
+  xSemaphoreGive(lock);
+  return found;
+}
+
+void RepellerLedger::write() {
+  uint16_t count = image.header.count;
+  image.header.crc = esp_rom_crc32_le(0, (const uint8_t*)image.entries, count * sizeof(RepellerLedgerEntry));
+  if (settings_store.write(REPELLER_LEDGER_KEY, (const uint8_t*)&image, image_size(count))) {
+    dirty = false;
+    flushes++;
+  }
+  flushed_at = millis();  // A failed write waits for the next interval too, rather than retrying every checkpoint
+}
+
+void RepellerLedger::flush_if_due() {
+  if (!lock) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (dirty && millis() - flushed_at >= REPELLER_LEDGER_FLUSH_INTERVAL_MS) {
+    write();
+  }
+  xSemaphoreGive(lock);
+}
+
+void RepellerLedger::flush() {
+  if (!lock) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (dirty) {
+    write();
+  }
+  xSemaphoreGive(lock);
+}
+
+uint16_t RepellerLedger::getCount() {
+  if (!lock) {
+    return 0;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t count = image.header.count;
+  xSemaphoreGive(lock);
+  return count;
+}
+
+bool RepellerLedger::getEntry(uint16_t index, RepellerLedgerEntry& entry) {
+  if (!lock) {
+    return false;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool exists = index < image.header.count;
+  if (exists) {
+    entry = image.entries[index];
+  }
+  xSemaphoreGive(lock);
+  return exists;
+}
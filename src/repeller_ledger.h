@@ -0,0 +1,81 @@
+#ifndef REPELLER_LEDGER_H
+#define REPELLER_LEDGER_H
+
+#include <Arduino.h>
+#include "repeller.h"
+
+#define REPELLER_LEDGER_KEY "repellers"           // settings_store key of the index
+#define REPELLER_LEDGER_MAGIC 0x58444952u         // "RIDX" on flash
+#define REPELLER_LEDGER_VERSION 2                 // 2: full 16-character serials, last_seen
+#define REPELLER_LEDGER_MAX_ENTRIES 64            // Both buses' worth of addresses (31 each), plus a couple of swaps
+#define REPELLER_LEDGER_FLUSH_INTERVAL_MS 300000  // Batched updates are written at most this often while running
+
+// One repeller's cartridge, keyed by the serial number read by Bus::retrieve_serial()
+struct __attribute__((packed)) RepellerLedgerEntry {
+  char serial[REPELLER_SERIAL_SIZE];  // NUL padded. Entries are sorted on this
+  uint32_t active_seconds;
+  uint32_t last_seen;                 // Ledger-wide counter value when it was last touched; the lowest is evicted
+  uint8_t last_bus;                   // Bus the repeller was last seen on
+  uint16_t warmup_complete_at;        // Warm-up counter value last seen in RX_WARMUP_COMP (0 if never)
+};
+
+// Index on flash: this header, then `count` entries. The CRC32 covers the entries
+struct __attribute__((packed)) RepellerLedgerHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t crc;
+};
+
+// Cartridge runtime per repeller, shared by both buses since units move between them. The whole index is one
+// record in settings_store (under 2 KB), and the RAM copy is kept in the same layout: a sorted array found by
+// binary search. Updates only change RAM; the buses call flush_if_due() at their runtime checkpoints and flush()
+// at power-down, so a checkpoint across a dozen repellers costs one write rather than one each. The per-bus
+// cartridge figures (the runtime journal) are unchanged and remain the aggregate for the bus.
+// When the index is full, a new serial takes the place of the one seen longest ago (a retired or swapped unit).
+// Everything may be called from any task.
+class RepellerLedger {
+private:
+  struct __attribute__((packed)) Image {
+    RepellerLedgerHeader header;
+    RepellerLedgerEntry entries[REPELLER_LEDGER_MAX_ENTRIES];
+  };
+
+  Image image;
+  SemaphoreHandle_t lock;  // Guards image and the fields below
+  bool dirty;
+  unsigned long flushed_at;  // millis() of the last write
+  uint32_t flushes;
+  uint32_t seen_counter;   // Stamped into last_seen. Restored from the entries on load
+  uint32_t evictions;
+
+  int find(const char* serial, bool& found) const;  // Index of serial, or where it would be inserted
+  RepellerLedgerEntry* find_or_insert(const char* serial);  // Evicts the least recently seen entry if full
+  void write();  // With the lock held
+
+public:
+  RepellerLedger();
+
+  bool begin();  // Load the index (call from setup, after the filesystem is mounted)
+
+  void touch(const char* serial, uint8_t bus_id);  // Create the entry if new, and note which bus it is on
+  void add(const char* serial, uint8_t bus_id, uint32_t seconds);
+  void set_warmup_complete_at(const char* serial, uint8_t bus_id, uint16_t value);
+  bool reset(const char* serial);                  // A new cartridge. Written straight away
+  bool lookup(const char* serial, RepellerLedgerEntry& entry);
+
+  void flush_if_due();  // Write pending updates if REPELLER_LEDGER_FLUSH_INTERVAL_MS has passed since the last write
+  void flush();         // Write pending updates now
+
+  uint16_t getCount();
+  bool getEntry(uint16_t index, RepellerLedgerEntry& entry);  // In serial order
+  uint32_t getFlushes() const { return flushes; }
+  uint32_t getEvictions() const { return evictions; }
+};
+
+// Whether data is a whole ledger index (a SettingsRecordCheck for settings_store)
+bool repeller_ledger_valid(const uint8_t* data, size_t length);
+
+extern RepellerLedger repeller_ledger;
+
+#endif
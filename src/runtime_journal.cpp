@@ -0,0 +1,138 @@
+#include "runtime_journal.h"
+#include <LittleFS.h>
+#include <esp_rom_crc.h>
+
+#define RUNTIME_JOURNAL_READ_RECORDS 32  // Records read per file.read() while replaying
+
+RuntimeJournal::RuntimeJournal() : total_seconds(0), record_count(0), next_sequence(0), appends(0), compactions(0) {
+  path[0] = '\0';
+  compact_path[0] = '\0';
+}
+
+uint8_t RuntimeJournal::check_of(const RuntimeRecord& record) {
+  uint8_t crc = esp_rom_crc8_le(0, &record.type, sizeof(record.type));
+  return esp_rom_crc8_le(crc, (const uint8_t*)&record.sequence, sizeof(record.sequence) + sizeof(record.value));
+}
+
+RuntimeRecord RuntimeJournal::make_record(RuntimeRecordType type, uint32_t value) {
+  RuntimeRecord record;
+  record.type = type;
+  record.sequence = next_sequence;
+  record.value = value;
+  record.check = check_of(record);
+  return record;
+}
+
+bool RuntimeJournal::begin(uint8_t bus_id) {
+  snprintf(path, sizeof(path), "/bus%d_runtime.log", bus_id);
+  snprintf(compact_path, sizeof(compact_path), "/bus%d_runtime.new", bus_id);
+
+  // A compaction that didn't get as far as the rename. If the old journal is gone, the new one is complete
+  if (LittleFS.exists(compact_path)) {
+    if (LittleFS.exists(path)) {
+      LittleFS.remove(compact_path);
+    } else {
+      LittleFS.rename(compact_path, path);
+    }
+  }
+
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return false;
+  }
+
+  RuntimeRecord records[RUNTIME_JOURNAL_READ_RECORDS];
+  bool ended_early = false;
+  size_t length;
+  while (!ended_early && (length = file.read((uint8_t*)records, sizeof(records))) > 0) {
+    size_t count = length / sizeof(RuntimeRecord);
+    if (count * sizeof(RuntimeRecord) != length) {
+      ended_early = true;  // Torn final record
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      const RuntimeRecord& record = records[i];
+      if (record.check != check_of(record) || (record_count > 0 && record.sequence != next_sequence) ||
+          (record.type != RUNTIME_RECORD_BASE && record.type != RUNTIME_RECORD_ADD)) {
+        ended_early = true;
+        break;
+      }
+
+      total_seconds = (record.type == RUNTIME_RECORD_BASE) ? record.value : total_seconds + record.value;
+      next_sequence = record.sequence + 1;
+      record_count++;
+    }
+  }
+  file.close();
+
+  if (record_count == 0) {
+    return false;
+  }
+
+  // Anything appended after a bad record would never be replayed, so start a clean file
+  if (ended_early) {
+    Serial.printf("RuntimeJournal: %s ends with a bad record after %d good ones, compacting\n", path, record_count);
+    compact();
+  }
+  return true;
+}
+
+bool RuntimeJournal::append(RuntimeRecordType type, uint32_t value) {
+  if (record_count + 1 >= RUNTIME_JOURNAL_MAX_RECORDS) {
+    return compact();  // total_seconds already includes the new value
+  }
+
+  File file = LittleFS.open(path, "a");
+  if (!file) {
+    Serial.printf("RuntimeJournal: Failed to open %s for appending\n", path);
+    return false;
+  }
+
+  RuntimeRecord record = make_record(type, value);
+  size_t written = file.write((const uint8_t*)&record, sizeof(record));
+  file.close();
+  if (written != sizeof(record)) {
+    Serial.printf("RuntimeJournal: Append to %s incomplete\n", path);
+    return false;
+  }
+
+  next_sequence++;
+  record_count++;
+  appends++;
+  return true;
+}
+
+bool RuntimeJournal::compact() {
+  File file = LittleFS.open(compact_path, "w");
+  if (!file) {
+    Serial.printf("RuntimeJournal: Failed to open %s for compaction\n", compact_path);
+    return false;
+  }
+
+  RuntimeRecord record = make_record(RUNTIME_RECORD_BASE, total_seconds);
+  size_t written = file.write((const uint8_t*)&record, sizeof(record));
+  file.close();
+  if (written != sizeof(record) || !LittleFS.rename(compact_path, path)) {
+    Serial.printf("RuntimeJournal: Compaction of %s failed\n", path);
+    LittleFS.remove(compact_path);
+    return false;
+  }
+
+  next_sequence++;
+  record_count = 1;
+  compactions++;
+  return true;
+}
+
+bool RuntimeJournal::add(uint32_t seconds) {
+  if (seconds == 0) {
+    return true;
+  }
+  total_seconds += seconds;
+  return append(RUNTIME_RECORD_ADD, seconds);
+}
+
+bool RuntimeJournal::reset(uint32_t seconds) {
+  total_seconds = seconds;
+  return append(RUNTIME_RECORD_BASE, seconds);
+}
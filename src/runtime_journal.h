@@ -0,0 +1,56 @@
+#ifndef RUNTIME_JOURNAL_H
+#define RUNTIME_JOURNAL_H
+
+#include <Arduino.h>
+
+#define RUNTIME_JOURNAL_MAX_RECORDS 512      // Compact once the journal holds this many records (4 KB)
+#define RUNTIME_JOURNAL_CHECKPOINT_MS 60000  // How often a running bus records its active time
+
+enum RuntimeRecordType : uint8_t {
+  RUNTIME_RECORD_BASE = 0xB5,  // The total is value (written by compaction and cartridge resets)
+  RUNTIME_RECORD_ADD = 0xAD    // Add value seconds to the total
+};
+
+struct __attribute__((packed)) RuntimeRecord {
+  uint8_t type;       // RuntimeRecordType
+  uint8_t check;      // CRC8 of the other fields
+  uint16_t sequence;  // One more than the record before it
+  uint32_t value;
+};
+
+// Cartridge active time for one bus, kept as an append-only file of small records instead of rewriting the
+// settings file on every checkpoint. Replaying the file gives the total; a record that is torn, corrupt or out
+// of sequence ends the replay (everything before it still counts). Once the file reaches
+// RUNTIME_JOURNAL_MAX_RECORDS it is compacted: a single BASE record is written to a new file, which is then
+// renamed over the old one, so a reset part way through leaves one or the other intact.
+class RuntimeJournal {
+private:
+  char path[24];
+  char compact_path[24];
+  uint32_t total_seconds;
+  uint16_t record_count;   // Records in the file
+  uint16_t next_sequence;
+  uint32_t appends;
+  uint32_t compactions;
+
+  static uint8_t check_of(const RuntimeRecord& record);
+  RuntimeRecord make_record(RuntimeRecordType type, uint32_t value);
+  bool append(RuntimeRecordType type, uint32_t value);
+  bool compact();
+
+public:
+  RuntimeJournal();
+
+  // Replay the journal for bus_id. Returns false if there was nothing to replay (first boot with a journal)
+  bool begin(uint8_t bus_id);
+
+  bool add(uint32_t seconds);
+  bool reset(uint32_t seconds = 0);  // Start again from seconds (a new cartridge, or seeding a new journal)
+
+  uint32_t getTotalSeconds() const { return total_seconds; }
+  uint16_t getRecordCount() const { return record_count; }
+  uint32_t getAppends() const { return appends; }
+  uint32_t getCompactions() const { return compactions; }
+};
+
+#endif
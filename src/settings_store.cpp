@@ -0,0 +1,111 @@
+#include "settings_store.h"
+#include <LittleFS.h>
+
+LittleFSSettingsStore littlefs_settings_store;
+NvsSettingsStore nvs_settings_store;
+
+#ifdef SETTINGS_STORE_NVS
+SettingsStore& settings_store = nvs_settings_store;
+#else
+SettingsStore& settings_store = littlefs_settings_store;
+#endif
+
+size_t LittleFSSettingsStore::read_file(const char* path, uint8_t* buffer, size_t size) {
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return 0;
+  }
+  size_t length = file.read(buffer, size);
+  file.close();
+  return length;
+}
+
+size_t LittleFSSettingsStore::read(const char* key, uint8_t* buffer, size_t size, SettingsRecordCheck check) {
+  char path[32];
+  char temp_path[32];
+  snprintf(path, sizeof(path), "/%s.dat", key);
+  snprintf(temp_path, sizeof(temp_path), "/%s.tmp", key);
+
+  if (LittleFS.exists(temp_path)) {
+    size_t length = read_file(temp_path, buffer, size);
+    if (length > 0 && check && check(buffer, length) && LittleFS.rename(temp_path, path)) {
+      Serial.printf("LittleFSSettingsStore: Recovered %s from an interrupted save\n", key);
+      return length;
+    }
+    LittleFS.remove(temp_path);
+  }
+
+  if (!LittleFS.exists(path)) {
+    return 0;
+  }
+  return read_file(path, buffer, size);
+}
+
+bool LittleFSSettingsStore::write(const char* key, const uint8_t* data, size_t length) {
+  char path[32];
+  char temp_path[32];
+  snprintf(path, sizeof(path), "/%s.dat", key);
+  snprintf(temp_path, sizeof(temp_path), "/%s.tmp", key);
+
+  File file = LittleFS.open(temp_path, "w");
+  if (!file) {
+    Serial.printf("LittleFSSettingsStore: Failed to open %s for writing\n", temp_path);
+    return false;
+  }
+
+  size_t written = file.write(data, length);
+  file.close();
+  if (written != length) {
+    Serial.printf("LittleFSSettingsStore: Write to %s incomplete (%d of %d bytes)\n", temp_path, written, length);
+    LittleFS.remove(temp_path);
+    return false;
+  }
+
+  if (!LittleFS.rename(temp_path, path)) {
+    Serial.printf("LittleFSSettingsStore: Failed to replace %s\n", path);
+    LittleFS.remove(temp_path);
+    return false;
+  }
+  return true;
+}
+
+bool LittleFSSettingsStore::remove(const char* key) {
+  char path[32];
+  snprintf(path, sizeof(path), "/%s.dat", key);
+  return !LittleFS.exists(path) || LittleFS.remove(path);
+}
+
+bool NvsSettingsStore::begin() {
+  if (!started) {
+    started = preferences.begin(SETTINGS_STORE_NVS_NAMESPACE, false);
+    if (!started) {
+      Serial.println("NvsSettingsStore: Failed to open the NVS namespace");
+    }
+  }
+  return started;
+}
+
+size_t NvsSettingsStore::read(const char* key, uint8_t* buffer, size_t size, SettingsRecordCheck check) {
+  if (!begin() || !preferences.isKey(key)) {
+    return 0;
+  }
+  return preferences.getBytes(key, buffer, size);
+}
+
+bool NvsSettingsStore::write(const char* key, const uint8_t* data, size_t length) {
+  if (!begin()) {
+    return false;
+  }
+  if (preferences.putBytes(key, data, length) != length) {
+    Serial.printf("NvsSettingsStore: Failed to write %s\n", key);
+    return false;
+  }
+  return true;
+}
+
+bool NvsSettingsStore::remove(const char* key) {
+  if (!begin() || !preferences.isKey(key)) {
+    return true;
+  }
+  return preferences.remove(key);
+}
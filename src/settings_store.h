@@ -0,0 +1,63 @@
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define SETTINGS_STORE_NVS_NAMESPACE "settings"
+
+// Decides whether a record left by an interrupted write is whole enough to use
+typedef bool (*SettingsRecordCheck)(const uint8_t* data, size_t length);
+
+// Where saved settings records live. A record is an opaque blob under a short key (at most 15 characters, for
+// NVS), and write() replaces it atomically: a reset part way through leaves the old record or the new one.
+// The buses use settings_store, which is LittleFS unless the env builds with -D SETTINGS_STORE_NVS.
+class SettingsStore {
+public:
+  virtual ~SettingsStore() {}
+
+  virtual const char* getName() const = 0;
+  virtual bool begin() = 0;
+
+  // Copy the record into buffer and return its length (0 if there isn't one)
+  virtual size_t read(const char* key, uint8_t* buffer, size_t size, SettingsRecordCheck check = nullptr) = 0;
+  virtual bool write(const char* key, const uint8_t* data, size_t length) = 0;
+  virtual bool remove(const char* key) = 0;
+};
+
+// /<key>.dat. Written to /<key>.tmp, then renamed over it; a .tmp found by read() is from a save that was
+// interrupted before the rename; it is newer, so it is used (and the rename finished) if check accepts it
+class LittleFSSettingsStore : public SettingsStore {
+private:
+  size_t read_file(const char* path, uint8_t* buffer, size_t size);
+
+public:
+  const char* getName() const override { return "LittleFS"; }
+  bool begin() override { return true; }  // Mounted by setup()
+  size_t read(const char* key, uint8_t* buffer, size_t size, SettingsRecordCheck check = nullptr) override;
+  bool write(const char* key, const uint8_t* data, size_t length) override;
+  bool remove(const char* key) override;
+};
+
+// Blobs in the SETTINGS_STORE_NVS_NAMESPACE namespace. NVS commits atomically on its own, so there is nothing
+// to recover
+class NvsSettingsStore : public SettingsStore {
+private:
+  Preferences preferences;
+  bool started;
+
+public:
+  NvsSettingsStore() : started(false) {}
+
+  const char* getName() const override { return "NVS"; }
+  bool begin() override;
+  size_t read(const char* key, uint8_t* buffer, size_t size, SettingsRecordCheck check = nullptr) override;
+  bool write(const char* key, const uint8_t* data, size_t length) override;
+  bool remove(const char* key) override;
+};
+
+extern LittleFSSettingsStore littlefs_settings_store;
+extern NvsSettingsStore nvs_settings_store;
+extern SettingsStore& settings_store;
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free ring buffer for handing items from exactly one producer to exactly one consumer (e.g. a UART
+// callback to a bus worker, or a bus worker to a front end). Neither side ever blocks, allocates or takes a
+// lock, so either may be an ISR. Waking the consumer up is left to the caller (a task notification, say).
+//
+// head and tail run freely and are only ever written by one side each: the producer publishes an item by
+// storing tail with release ordering after writing the slot, and the consumer frees a slot by storing head
+// after reading it. Capacity must be a power of two so the counters can wrap.
+template <typename T, size_t Capacity>
+class SpscRing {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+private:
+  T items[Capacity];
+  std::atomic<uint32_t> head;  // Next slot to read (written by the consumer)
+  std::atomic<uint32_t> tail;  // Next slot to write (written by the producer)
+
+public:
+  SpscRing() : head(0), tail(0) {}
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  // Producer side. Returns false if the ring is full
+  bool push(const T& item) {
+    uint32_t write_at = tail.load(std::memory_order_relaxed);
+    if (write_at - head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    items[write_at & (Capacity - 1)] = item;
+    tail.store(write_at + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false if the ring is empty
+  bool pop(T& item) {
+    uint32_t read_at = head.load(std::memory_order_relaxed);
+    if (read_at == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = items[read_at & (Capacity - 1)];
+    head.store(read_at + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Either side. Only a hint while the other side is running
+  size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return Capacity; }
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "timer_service.h"
+
+TimerService timer_service;
+
+TimerService::TimerService() : timer_count(0), handle(nullptr), lock(nullptr), fired_count(0) {}
+
+// The esp_timer and the lock are created when the first timer is added (from setup), not at static init
+bool TimerService::begin() {
+  if (handle) {
+    return true;
+  }
+
+  lock = xSemaphoreCreateMutex();
+  if (!lock) {
+    Serial.println("TimerService: Failed to create lock");
+    return false;
+  }
+
+  esp_timer_create_args_t args = {};
+  args.callback = on_fire;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "timer_service";
+  esp_err_t err = esp_timer_create(&args, &handle);
+  if (err != ESP_OK) {
+    Serial.printf("TimerService: Failed to create esp_timer: %s\n", esp_err_to_name(err));
+    handle = nullptr;
+    return false;
+  }
+  return true;
+}
+
+TimerId TimerService::add(TimerCallback callback, void* arg) {
+  if (!begin()) {
+    return TIMER_INVALID;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  TimerId id = TIMER_INVALID;
+  if (timer_count < TIMER_SERVICE_MAX_TIMERS) {
+    id = timer_count++;
+    timers[id].callback = callback;
+    timers[id].arg = arg;
+    timers[id].deadline_us = 0;
+    timers[id].period_ms = 0;
+    timers[id].armed = false;
+  }
+  xSemaphoreGive(lock);
+
+  if (id == TIMER_INVALID) {
+    Serial.printf("TimerService: Cannot add timer, already have %d\n", TIMER_SERVICE_MAX_TIMERS);
+  }
+  return id;
+}
+
+void TimerService::arm_in(TimerId id, uint32_t delay_ms) {
+  arm_at(id, esp_timer_get_time() + (int64_t)delay_ms * 1000);
+}
+
+void TimerService::arm_at(TimerId id, int64_t deadline_us) {
+  if (id < 0 || id >= timer_count) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  timers[id].deadline_us = deadline_us;
+  timers[id].period_ms = 0;
+  timers[id].armed = true;
+  rearm();
+  xSemaphoreGive(lock);
+}
+
+void TimerService::arm_periodic(TimerId id, uint32_t period_ms) {
+  if (id < 0 || id >= timer_count || period_ms == 0) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  timers[id].deadline_us = esp_timer_get_time() + (int64_t)period_ms * 1000;
+  timers[id].period_ms = period_ms;
+  timers[id].armed = true;
+  rearm();
+  xSemaphoreGive(lock);
+}
+
+void TimerService::disarm(TimerId id) {
+  if (id < 0 || id >= timer_count) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (timers[id].armed) {
+    timers[id].armed = false;
+    rearm();  // A spurious wake-up would be harmless, but there's no need for one
+  }
+  xSemaphoreGive(lock);
+}
+
+bool TimerService::isArmed(TimerId id) {
+  if (id < 0 || id >= timer_count) {
+    return false;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool armed = timers[id].armed;
+  xSemaphoreGive(lock);
+  return armed;
+}
+
+void TimerService::on_fire(void* arg) {
+  static_cast<TimerService*>(arg)->run_due();
+}
+
+// Collect what is due (moving periodic timers on, disarming one-shots), make the calls without the lock so
+// that callbacks may re-arm their own timers, then arm the esp_timer for whatever is next
+void TimerService::run_due() {
+  TimerCallback due[TIMER_SERVICE_MAX_TIMERS];
+  void* due_args[TIMER_SERVICE_MAX_TIMERS];
+  uint8_t due_count = 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int64_t now = esp_timer_get_time();
+  for (uint8_t i = 0; i < timer_count; i++) {
+    Timer& timer = timers[i];
+    if (!timer.armed || timer.deadline_us > now) {
+      continue;
+    }
+
+    due[due_count] = timer.callback;
+    due_args[due_count] = timer.arg;
+    due_count++;
+
+    if (timer.period_ms) {
+      timer.deadline_us += (int64_t)timer.period_ms * 1000;
+      if (timer.deadline_us <= now) {
+        timer.deadline_us = now + (int64_t)timer.period_ms * 1000;  // Fell behind - skip the missed periods
+      }
+    } else {
+      timer.armed = false;
+    }
+  }
+  fired_count += due_count;
+  xSemaphoreGive(lock);
+
+  for (uint8_t i = 0; i < due_count; i++) {
+    due[i](due_args[i]);
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  rearm();
+  xSemaphoreGive(lock);
+}
+
+void TimerService::rearm() {
+  int64_t next = INT64_MAX;
+  for (uint8_t i = 0; i < timer_count; i++) {
+    if (timers[i].armed && timers[i].deadline_us < next) {
+      next = timers[i].deadline_us;
+    }
+  }
+
+  esp_timer_stop(handle);  // Fails harmlessly if it wasn't running
+  if (next == INT64_MAX) {
+    return;
+  }
+
+  int64_t delay_us = next - esp_timer_get_time();
+  esp_timer_start_once(handle, delay_us > 0 ? delay_us : 0);
+}
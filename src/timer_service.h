@@ -0,0 +1,54 @@
+#ifndef TIMER_SERVICE_H
+#define TIMER_SERVICE_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#define TIMER_SERVICE_MAX_TIMERS 12  // A few per bus, plus the front ends
+#define TIMER_INVALID -1
+
+typedef int8_t TimerId;
+typedef void (*TimerCallback)(void* arg);
+
+// One-shot and periodic deadlines on a single esp_timer, which is only ever armed for the earliest one. With a
+// dozen timers at most, a linear scan of the table when one fires is cheaper than keeping a wheel or heap.
+// Callbacks run on the esp_timer task, so they should only post a command, set a signal or notify a task.
+// Everything may be called from any task (but not from an ISR).
+class TimerService {
+private:
+  struct Timer {
+    TimerCallback callback;
+    void* arg;
+    int64_t deadline_us;  // esp_timer_get_time() at which it is next due
+    uint32_t period_ms;   // 0 for a one-shot
+    bool armed;
+  };
+
+  Timer timers[TIMER_SERVICE_MAX_TIMERS];
+  uint8_t timer_count;
+  esp_timer_handle_t handle;
+  SemaphoreHandle_t lock;  // Guards the table and the esp_timer (callbacks are made without it)
+  uint32_t fired_count;
+
+  bool begin();
+  static void on_fire(void* arg);
+  void run_due();
+  void rearm();  // With the lock held
+
+public:
+  TimerService();
+
+  TimerId add(TimerCallback callback, void* arg);  // TIMER_INVALID if the table is full. Starts disarmed
+
+  void arm_in(TimerId id, uint32_t delay_ms);      // One-shot, replacing any earlier deadline
+  void arm_at(TimerId id, int64_t deadline_us);    // One-shot at an esp_timer_get_time() value
+  void arm_periodic(TimerId id, uint32_t period_ms);
+  void disarm(TimerId id);
+  bool isArmed(TimerId id);
+
+  uint32_t getFiredCount() const { return fired_count; }
+};
+
+extern TimerService timer_service;
+
+#endif
@@ -0,0 +1,282 @@
+#include "usage_history.h"
+#include "settings_store.h"
+#include <esp_rom_crc.h>
+#include <time.h>
+
+#define USAGE_HISTORY_MAX_RECORD 20  // Four varints of up to five bytes each
+
+static size_t put_varint(uint8_t* out, uint32_t value) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[length++] = value;
+  return length;
+}
+
+// Returns the offset after the varint, or 0 if it runs past length
+static size_t get_varint(const uint8_t* data, size_t length, size_t offset, uint32_t& value) {
+  value = 0;
+  for (uint8_t shift = 0; offset < length && shift < 35; shift += 7) {
+    uint8_t byte = data[offset++];
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return offset;
+    }
+  }
+  return 0;
+}
+
+bool usage_history_valid(const uint8_t* data, size_t length) {
+  if (length < sizeof(UsageHistoryHeader)) {
+    return false;
+  }
+
+  UsageHistoryHeader header;
+  memcpy(&header, data, sizeof(header));
+  return header.magic == USAGE_HISTORY_MAGIC && header.version == USAGE_HISTORY_VERSION &&
+         header.length <= USAGE_HISTORY_BYTES && length == sizeof(header) + header.length &&
+         header.crc == esp_rom_crc32_le(0, data + sizeof(header), header.length);
+}
+
+UsageHistory::UsageHistory() : current{0, 0, 0, 0}, dirty(false), bucket_count(0), lock(nullptr) {
+  key[0] = '\0';
+  memset(&image.header, 0, sizeof(image.header));
+}
+
+uint32_t UsageHistory::clock_hour() {
+  time_t now = time(nullptr);
+  return (now >= USAGE_HISTORY_CLOCK_VALID) ? now / 3600 : 0;
+}
+
+size_t UsageHistory::decode(const uint8_t* data, size_t length, size_t offset, uint32_t& hour_delta,
+                            UsageBucket& bucket) {
+  uint32_t power_ons;
+  uint32_t auto_shutoffs;
+  if (!(offset = get_varint(data, length, offset, hour_delta)) ||
+      !(offset = get_varint(data, length, offset, bucket.active_seconds)) ||
+      !(offset = get_varint(data, length, offset, power_ons)) ||
+      !(offset = get_varint(data, length, offset, auto_shutoffs))) {
+    return 0;
+  }
+  bucket.power_ons = power_ons;
+  bucket.auto_shutoffs = auto_shutoffs;
+  return offset;
+}
+
+bool UsageHistory::begin(uint8_t bus_id) {
+  if (!lock) {
+    lock = xSemaphoreCreateMutex();
+    if (!lock) {
+      Serial.printf("UsageHistory: Failed to create lock for bus %d\n", bus_id);
+      return false;
+    }
+  }
+  snprintf(key, sizeof(key), "bus%d_history", bus_id);
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  size_t length = littlefs_settings_store.read(key, (uint8_t*)&image, sizeof(image), usage_history_valid);
+  bool loaded = length > 0 && usage_history_valid((const uint8_t*)&image, length);
+  if (loaded) {
+    current.hour = image.header.current_hour;
+    current.active_seconds = image.header.current_active_seconds;
+    current.power_ons = image.header.current_power_ons;
+    current.auto_shutoffs = image.header.current_auto_shutoffs;
+
+    size_t offset = 0;
+    uint32_t hour_delta;
+    UsageBucket bucket;
+    bucket_count = 0;
+    while (offset < image.header.length &&
+           (offset = decode(image.buckets, image.header.length, offset, hour_delta, bucket))) {
+      bucket_count++;
+    }
+  } else {
+    if (length > 0) {
+      Serial.printf("UsageHistory: %s is invalid, starting a new history\n", key);
+    }
+    memset(&image.header, 0, sizeof(image.header));
+    image.header.magic = USAGE_HISTORY_MAGIC;
+    image.header.version = USAGE_HISTORY_VERSION;
+    current = {0, 0, 0, 0};
+    bucket_count = 0;
+  }
+  Serial.printf("UsageHistory: Bus %d has %d hourly buckets (%d bytes)\n", bus_id, bucket_count,
+                image.header.length);
+  xSemaphoreGive(lock);
+  return loaded;
+}
+
+void UsageHistory::drop_oldest() {
+  uint16_t length = image.header.length;
+  uint32_t hour_delta;
+  UsageBucket bucket;
+  size_t next = decode(image.buckets, length, 0, hour_delta, bucket);
+  if (next == 0 || next >= length) {
+    image.header.length = 0;
+    bucket_count = 0;
+    return;
+  }
+
+  // The second bucket's delta is from the first, so it gives the new oldest hour
+  decode(image.buckets, length, next, hour_delta, bucket);
+  image.header.first_hour += hour_delta;
+  memmove(image.buckets, image.buckets + next, length - next);
+  image.header.length = length - next;
+  bucket_count--;
+}
+
+void UsageHistory::append(const UsageBucket& bucket) {
+  uint8_t record[USAGE_HISTORY_MAX_RECORD];
+  size_t length = 0;
+  while (true) {
+    uint32_t hour_delta = (image.header.length == 0) ? 0 : bucket.hour - image.header.last_hour;
+    length = put_varint(record, hour_delta);
+    length += put_varint(record + length, bucket.active_seconds);
+    length += put_varint(record + length, bucket.power_ons);
+    length += put_varint(record + length, bucket.auto_shutoffs);
+    if (image.header.length == 0 || image.header.length + length <= USAGE_HISTORY_BYTES) {
+      break;
+    }
+    drop_oldest();
+  }
+  if (image.header.length == 0) {
+    image.header.first_hour = bucket.hour;
+  }
+
+  memcpy(image.buckets + image.header.length, record, length);
+  image.header.length += length;
+  image.header.last_hour = bucket.hour;
+  bucket_count++;
+}
+
+bool UsageHistory::roll(uint32_t hour) {
+  if (hour == 0 || hour <= current.hour) {
+    return false;  // No clock, the same hour, or the clock stepped back (keep adding to the open bucket)
+  }
+
+  if (current.hour == 0) {
+    current.hour = hour;  // The first hour since the clock was set takes what was recorded before it
+    dirty = true;
+    return false;
+  }
+
+  bool closed = current.active_seconds > 0 || current.power_ons > 0 || current.auto_shutoffs > 0;
+  if (closed) {
+    append(current);
+  }
+  current = {hour, 0, 0, 0};
+  dirty = true;
+  return closed;
+}
+
+void UsageHistory::add_active_seconds(uint32_t seconds) {
+  if (!lock || seconds == 0) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint32_t hour = clock_hour();
+  if (hour != 0 && current.hour + 1 == hour) {
+    // Split a checkpoint that straddles the hour between the two buckets
+    uint32_t into_hour = time(nullptr) % 3600;
+    if (seconds > into_hour) {
+      current.active_seconds += seconds - into_hour;
+      seconds = into_hour;
+    }
+  }
+  bool closed = roll(hour);
+  current.active_seconds += seconds;
+  dirty = true;
+  xSemaphoreGive(lock);
+
+  if (closed) {
+    save();
+  }
+}
+
+void UsageHistory::count_power_on() {
+  if (!lock) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool closed = roll(clock_hour());
+  current.power_ons++;
+  dirty = true;
+  xSemaphoreGive(lock);
+
+  if (closed) {
+    save();
+  }
+}
+
+void UsageHistory::count_auto_shutoff() {
+  if (!lock) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool closed = roll(clock_hour());
+  current.auto_shutoffs++;
+  dirty = true;
+  xSemaphoreGive(lock);
+
+  if (closed) {
+    save();
+  }
+}
+
+bool UsageHistory::save() {
+  if (!lock) {
+    return false;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool saved = true;
+  if (dirty) {
+    image.header.current_hour = current.hour;
+    image.header.current_active_seconds = current.active_seconds;
+    image.header.current_power_ons = current.power_ons;
+    image.header.current_auto_shutoffs = current.auto_shutoffs;
+    image.header.crc = esp_rom_crc32_le(0, image.buckets, image.header.length);
+    saved = littlefs_settings_store.write(key, (const uint8_t*)&image, sizeof(image.header) + image.header.length);
+    dirty = !saved;
+  }
+  xSemaphoreGive(lock);
+  return saved;
+}
+
+size_t UsageHistory::query(uint32_t from_hour, uint32_t to_hour, UsageBucket* out, size_t max) {
+  if (!lock || max == 0) {
+    return 0;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  size_t count = 0;
+  size_t offset = 0;
+  uint16_t length = image.header.length;
+  uint32_t hour = image.header.first_hour;
+  bool first = true;
+  uint32_t hour_delta;
+  UsageBucket bucket;
+  while (offset < length && count < max && (offset = decode(image.buckets, length, offset, hour_delta, bucket))) {
+    hour = first ? image.header.first_hour : hour + hour_delta;
+    first = false;
+    if (hour > to_hour) {
+      break;
+    }
+    if (hour >= from_hour) {
+      bucket.hour = hour;
+      out[count++] = bucket;
+    }
+  }
+
+  if (count < max && current.hour >= from_hour && current.hour <= to_hour && current.hour != 0 &&
+      (current.active_seconds > 0 || current.power_ons > 0 || current.auto_shutoffs > 0)) {
+    out[count++] = current;
+  }
+  xSemaphoreGive(lock);
+  return count;
+}
@@ -0,0 +1,82 @@
+#ifndef USAGE_HISTORY_H
+#define USAGE_HISTORY_H
+
+#include <Arduino.h>
+
+#define USAGE_HISTORY_BYTES 2048          // Encoded buckets kept per bus (about 5 bytes per hour with any use)
+#define USAGE_HISTORY_MAGIC 0x54534855u   // "UHST" on flash
+#define USAGE_HISTORY_VERSION 1
+#define USAGE_HISTORY_CLOCK_VALID 1704067200  // time() before 2024 means the clock hasn't been set yet
+
+// One hour of use. hour is the Unix time / 3600 (0 if the clock hasn't been set yet)
+struct UsageBucket {
+  uint32_t hour;
+  uint32_t active_seconds;
+  uint16_t power_ons;
+  uint16_t auto_shutoffs;
+};
+
+// Saved with the buckets, so the hour in progress survives a restart
+struct __attribute__((packed)) UsageHistoryHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;         // Bytes of encoded buckets after the header
+  uint32_t first_hour;     // Hour of the oldest bucket
+  uint32_t last_hour;      // Hour of the newest one (the next bucket's delta is from this)
+  uint32_t current_hour;   // The open bucket
+  uint32_t current_active_seconds;
+  uint16_t current_power_ons;
+  uint16_t current_auto_shutoffs;
+  uint32_t crc;            // CRC32 of the encoded buckets
+};
+
+// Hourly usage for one bus. Closed buckets are stored as four varints - hours since the previous bucket, active
+// seconds, power-ons, auto shut-offs - so an hour with use takes about 5 bytes and hours without any take none.
+// The buffer is a fixed-size ring kept in order: when it is full the oldest buckets are dropped by shifting the
+// rest down (at most once an hour), so the buffer is also the on-flash layout, written to LittleFS when a bucket
+// closes and when the bus powers down.
+// Hours come from the wall clock (SNTP in WiFi mode). Use before the clock is set goes into the open bucket and
+// is given the first hour the clock reports.
+// The bus worker records; query() may be called from any task.
+class UsageHistory {
+private:
+  struct __attribute__((packed)) Image {
+    UsageHistoryHeader header;
+    uint8_t buckets[USAGE_HISTORY_BYTES];
+  };
+
+  char key[16];
+  Image image;
+  UsageBucket current;
+  bool dirty;              // current or the ring changed since the last save()
+  uint16_t bucket_count;
+  SemaphoreHandle_t lock;  // Guards image, current and bucket_count
+
+  static uint32_t clock_hour();  // 0 if the clock isn't set
+  static size_t decode(const uint8_t* data, size_t length, size_t offset, uint32_t& hour_delta, UsageBucket& bucket);
+  bool roll(uint32_t hour);     // Close the open bucket if hour is later (true if it held anything). With the lock held
+  void append(const UsageBucket& bucket);
+  void drop_oldest();
+
+public:
+  UsageHistory();
+
+  bool begin(uint8_t bus_id);  // Load the saved history (call from Bus::init())
+  bool save();                 // Write the history if it has changed
+
+  void add_active_seconds(uint32_t seconds);
+  void count_power_on();
+  void count_auto_shutoff();
+
+  // Copy up to max buckets with from_hour <= hour <= to_hour, oldest first, into out (the open bucket included).
+  // Returns how many were copied; call again from the last hour + 1 for more
+  size_t query(uint32_t from_hour, uint32_t to_hour, UsageBucket* out, size_t max);
+
+  uint16_t getBucketCount() const { return bucket_count; }
+  uint16_t getBytesUsed() const { return image.header.length; }
+};
+
+// Whether data is a whole saved history (a SettingsRecordCheck for littlefs_settings_store)
+bool usage_history_valid(const uint8_t* data, size_t length);
+
+#endif
@@ -3,9 +3,38 @@
 // Global instances
 WiFiRepellerDevice* wifi_bus0_device = nullptr;
 WiFiRepellerDevice* wifi_bus1_device = nullptr;
-WebServer* web_server = nullptr;
+httpd_handle_t web_server = nullptr;
 WiFiManager wifiManager;
 
+// Recent bus events for GET /api/events, copied out of the event hub by wifi_controller_loop()
+static BusEventQueue* wifi_events = nullptr;
+static BusEvent event_log[WIFI_EVENT_LOG_SIZE];  // Ring - the newest event is at (event_log_count - 1) % size
+static uint32_t event_log_count = 0;
+static uint32_t event_log_resync_before = 0;     // Events before this sequence number may have been dropped
+static portMUX_TYPE event_log_mux = portMUX_INITIALIZER_UNLOCKED;  // The loop task writes these, handlers read them
+
+// loop() sleeps on a task notification, given by the bus event hub, the WiFi event handler and the reconnect
+// timer, rather than spinning. HTTP requests are served by the server's own task, so they don't wake it
+static TaskHandle_t loop_task = nullptr;
+static volatile bool wifi_check_pending = false;  // The station may have dropped off the network
+static TimerId reconnect_timer = TIMER_INVALID;
+
+static void wake_loop() {
+    if (loop_task) {
+        xTaskNotifyGive(loop_task);
+    }
+}
+
+static void on_wifi_disconnected(arduino_event_id_t event) {
+    wifi_check_pending = true;
+    wake_loop();
+}
+
+static void on_reconnect_timer(void* arg) {
+    wifi_check_pending = true;
+    wake_loop();
+}
+
 // WiFiRepellerDevice implementation
 WiFiRepellerDevice::WiFiRepellerDevice(uint8_t id, Bus* bus) : bus_id(id), controlled_bus(bus) {
     Serial.printf("WiFiRepellerDevice created for Bus %d\n", bus_id);
@@ -17,15 +46,44 @@ WiFiRepellerDevice::~WiFiRepellerDevice() {
 
 String WiFiRepellerDevice::getBusStatusJson() {
     JsonDocument doc;
+    BusSnapshot snapshot = controlled_bus->get_snapshot();
     
     doc["bus_id"] = bus_id;
-    doc["state"] = controlled_bus->getStateString();
-    doc["powered"] = (controlled_bus->getState() != BUS_OFFLINE);
-    doc["brightness"] = controlled_bus->zigbee_brightness() + 1; // Convert 0-254 to 1-255 for HTTP API
-    doc["color"]["red"] = controlled_bus->repeller_red();
-    doc["color"]["green"] = controlled_bus->repeller_green();
-    doc["color"]["blue"] = controlled_bus->repeller_blue();
-    doc["repeller_count"] = controlled_bus->getRepellers().size();
+    doc["state"] = bus_state_string(snapshot.state);
+    doc["powered"] = (snapshot.state != BUS_OFFLINE);
+    doc["desired_power"] = snapshot.desired_power;
+    doc["brightness"] = snapshot.brightness + 1; // Convert 0-254 to 1-255 for HTTP API
+    doc["color"]["red"] = snapshot.red;
+    doc["color"]["green"] = snapshot.green;
+    doc["color"]["blue"] = snapshot.blue;
+    doc["repeller_count"] = snapshot.repeller_count;
+    doc["commands"]["color"]["received"] = snapshot.color_commands;
+    doc["commands"]["color"]["coalesced"] = snapshot.color_commands_coalesced;
+    doc["commands"]["brightness"]["received"] = snapshot.brightness_commands;
+    doc["commands"]["brightness"]["coalesced"] = snapshot.brightness_commands_coalesced;
+    doc["command_latency_ms"]["p50"] = snapshot.command_latency_p50_ms;
+    doc["command_latency_ms"]["p99"] = snapshot.command_latency_p99_ms;
+    doc["command_latency_ms"]["samples"] = snapshot.command_latency_samples;
+    if (snapshot.state == BUS_WARMING_UP) {
+        doc["warm_up_eta_ms"] = snapshot.warm_up_eta_ms;
+    }
+    doc["power_up"]["last_ms"] = snapshot.last_power_up_ms;
+    doc["power_up"]["max_ms"] = snapshot.max_power_up_ms;
+    doc["power_up"]["count"] = snapshot.power_up_count;
+    doc["power_up"]["timeouts"] = snapshot.power_up_timeouts;
+    doc["settings"]["changes"] = snapshot.settings_changes;
+    doc["settings"]["flushes"] = snapshot.settings_flushes;
+    doc["settings"]["flush_last_us"] = snapshot.settings_flush_last_us;
+    doc["settings"]["flush_max_us"] = snapshot.settings_flush_max_us;
+    doc["settings"]["dirty"] = snapshot.settings_dirty;
+
+    // The running job if there is one, otherwise the most recently finished one
+    if (snapshot.job.id != 0) {
+        doc["job"]["id"] = snapshot.job.id;
+        doc["job"]["type"] = snapshot.job.getTypeString();
+        doc["job"]["phase"] = snapshot.job.getPhaseString();
+        doc["job"]["progress"] = snapshot.job.progress;
+    }
     
     String output;
     serializeJson(doc, output);
@@ -34,19 +92,58 @@ String WiFiRepellerDevice::getBusStatusJson() {
 
 String WiFiRepellerDevice::getCartridgeStatusJson() {
     JsonDocument doc;
+    BusSnapshot snapshot = controlled_bus->get_snapshot();
     
     doc["bus_id"] = bus_id;
-    doc["runtime_hours"] = controlled_bus->get_cartridge_runtime_hours();
-    doc["percent_left"] = controlled_bus->get_cartridge_percent_left();
-    doc["active_seconds"] = controlled_bus->get_cartridge_active_seconds();
-    doc["warn_at_hours"] = controlled_bus->get_cartridge_warn_at_seconds() / 3600;
-    doc["auto_shutoff_seconds"] = controlled_bus->get_auto_shut_off_after_seconds();
+    doc["runtime_hours"] = snapshot.cartridge_runtime_hours;
+    doc["percent_left"] = snapshot.cartridge_percent_left;
+    doc["active_seconds"] = snapshot.cartridge_active_seconds;
+    doc["warn_at_hours"] = snapshot.cartridge_warn_at_seconds / 3600;
+    doc["auto_shutoff_seconds"] = snapshot.auto_shut_off_after_seconds;
+    doc["journal"]["records"] = snapshot.runtime_journal_records;
+    doc["journal"]["compactions"] = snapshot.runtime_journal_compactions;
+    doc["history"]["buckets"] = snapshot.usage_history_buckets;
+    doc["history"]["bytes"] = snapshot.usage_history_bytes;
     
     String output;
     serializeJson(doc, output);
     return output;
 }
 
+// The repellers on this bus, each with its own cartridge runtime from the ledger. active_seconds at the top is
+// the bus's figure, which counts all of them (including any whose serial hasn't been read)
+String WiFiRepellerDevice::getRepellersJson() {
+    JsonDocument doc;
+    BusSnapshot snapshot = controlled_bus->get_snapshot();
+
+    doc["bus_id"] = bus_id;
+    doc["active_seconds"] = snapshot.cartridge_active_seconds;
+    doc["repeller_count"] = snapshot.repeller_count;
+    JsonArray list = doc["repellers"].to<JsonArray>();
+    uint8_t listed = (snapshot.repeller_count < BUS_SNAPSHOT_REPELLERS) ? snapshot.repeller_count : BUS_SNAPSHOT_REPELLERS;
+    for (uint8_t i = 0; i < listed; i++) {
+        const RepellerSummary& summary = snapshot.repellers[i];
+        JsonObject item = list.add<JsonObject>();
+        item["address"] = summary.address;
+        item["state"] = repeller_state_string(summary.state);
+        item["serial"] = summary.serial;
+
+        RepellerLedgerEntry entry;
+        if (repeller_ledger.lookup(summary.serial, entry)) {
+            item["active_seconds"] = entry.active_seconds;
+            item["runtime_hours"] = entry.active_seconds / 3600;
+            uint32_t warn_at = snapshot.cartridge_warn_at_seconds;
+            if (warn_at > 0) {
+                item["percent_left"] = (entry.active_seconds >= warn_at) ? 0 : (uint32_t)(((uint64_t)(warn_at - entry.active_seconds) * 100) / warn_at);
+            }
+        }
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return output;
+}
+
 String WiFiRepellerDevice::getSystemStatusJson() {
     JsonDocument doc;
     
@@ -70,9 +167,19 @@ void wifi_controller_setup() {
     wifi_bus0_device = new WiFiRepellerDevice(0, &bus0);
     wifi_bus1_device = new WiFiRepellerDevice(1, &bus1);
     
+    // Subscribe before the buses start so the feed has their first transitions too. setup() and loop() share a
+    // task, so this is the task that wifi_controller_loop() sleeps in
+    loop_task = xTaskGetCurrentTaskHandle();
+    wifi_events = bus_events.subscribe(BUS_EVENT_MASK_ALL, loop_task);
+    start_bus_event_logger();
+
     // Initialize both buses
     bus0.init();
     bus1.init();
+    bus_arbiter.add(&bus0);
+    bus_arbiter.add(&bus1);
+    bus0.start();
+    bus1.start();
     
     // Setup WiFiManager
     wifiManager.setConfigPortalTimeout(300); // 5 minute timeout
@@ -88,6 +195,11 @@ void wifi_controller_setup() {
     Serial.println("WiFi Connected!");
     Serial.print("IP Address: ");
     Serial.println(WiFi.localIP());
+
+    configTime(0, 0, WIFI_NTP_SERVER);  // UTC. The usage history needs the time of day; nothing else does
+
+    reconnect_timer = timer_service.add(on_reconnect_timer, nullptr);
+    WiFi.onEvent(on_wifi_disconnected, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
     
     // Setup mDNS with GUID-based identifier
     char guid[17];
@@ -103,41 +215,119 @@ void wifi_controller_setup() {
         MDNS.addService(WIFI_MDNS_SERVICE, "tcp", WIFI_WEB_PORT);
     }
     
-    // Initialize web server
-    web_server = new WebServer(WIFI_WEB_PORT);
+    // Initialize web server. esp_http_server accepts and serves connections in a task of its own, so loop() is
+    // left with just the bus events and the WiFi link
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = WIFI_WEB_PORT;
+    config.task_priority = WIFI_HTTP_TASK_PRIORITY;
+    config.stack_size = WIFI_HTTP_STACK_SIZE;
+    config.max_uri_handlers = WIFI_HTTP_MAX_HANDLERS;
+    config.max_open_sockets = WIFI_HTTP_MAX_SOCKETS;
+    config.lru_purge_enable = true;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    if (httpd_start(&web_server, &config) != ESP_OK) {
+        Serial.println("Failed to start web server, restarting...");
+        delay(3000);
+        ESP.restart();
+    }
     setupWebServerRoutes();
-    web_server->begin();
     
-    Serial.println("Web server started on port 80");
+    Serial.printf("Web server started on port %d\n", WIFI_WEB_PORT);
     Serial.println("WiFi Controller initialization complete!");
 }
 
 void wifi_controller_loop() {
-    // Handle incoming web requests
-    web_server->handleClient();
-    
-    // Monitor WiFi connection
-    if (!WiFi.isConnected()) {
-        Serial.println("WiFi disconnected, attempting reconnection...");
-        WiFi.reconnect();
+    // Sleep until there is something to do
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // Reconnect on a disconnect event, then keep retrying on the timer until it sticks
+    if (wifi_check_pending) {
+        wifi_check_pending = false;
+        if (!WiFi.isConnected()) {
+            Serial.println("WiFi disconnected, attempting reconnection...");
+            WiFi.reconnect();
+            timer_service.arm_in(reconnect_timer, WIFI_RECONNECT_RETRY_MS);
+        }
     }
-    
-    // Update cartridge monitoring for active buses
-    if (bus0.getState() == BUS_WARMING_UP || bus0.getState() == BUS_REPELLING) {
-        bus0.poll();  // Poll bus 0 for status updates
-        if (bus0.past_automatic_shutoff()) {
-            Serial.println("Bus 0 auto-shutoff triggered");
-            bus0.ZigbeePowerOff();
+
+    // The buses run (and check their own auto-shutoff) in their worker tasks. Keep up with what they publish
+    if (wifi_events) {
+        if (wifi_events->take_overflow()) {
+            portENTER_CRITICAL(&event_log_mux);
+            event_log_resync_before = bus_events.getPublishedCount();
+            portEXIT_CRITICAL(&event_log_mux);
+            log_resync_to_flash(EVENT_LOG_SOURCE_WIFI, wifi_events->getDropped());
+        }
+        BusEvent event;
+        while (wifi_events->pop(event)) {
+            portENTER_CRITICAL(&event_log_mux);
+            event_log[event_log_count % WIFI_EVENT_LOG_SIZE] = event;
+            event_log_count++;
+            portEXIT_CRITICAL(&event_log_mux);
         }
     }
-    
-    if (bus1.getState() == BUS_WARMING_UP || bus1.getState() == BUS_REPELLING) {
-        bus1.poll();  // Poll bus 1 for status updates
-        if (bus1.past_automatic_shutoff()) {
-            Serial.println("Bus 1 auto-shutoff triggered");
-            bus1.ZigbeePowerOff();
+}
+
+// ApiRequest implementation
+ApiRequest::ApiRequest(httpd_req_t* request) : req(request) {
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        query[0] = '\0';
+    }
+
+    // Form fields from a POST (application/x-www-form-urlencoded, as curl -d sends them). A body too long to be
+    // one is left unread, and the server discards it after the handler
+    body[0] = '\0';
+    size_t length = req->content_len;
+    if (length > 0 && length < sizeof(body)) {
+        size_t received = 0;
+        while (received < length) {
+            int result = httpd_req_recv(req, body + received, length - received);
+            if (result <= 0) {
+                break;  // Closed, or nothing for the server's receive timeout
+            }
+            received += result;
+        }
+        body[received] = '\0';
+    }
+}
+
+esp_err_t ApiRequest::find(const char* name, char* value, size_t size) {
+    esp_err_t result = httpd_query_key_value(query, name, value, size);
+    return (result == ESP_ERR_NOT_FOUND) ? httpd_query_key_value(body, name, value, size) : result;
+}
+
+bool ApiRequest::hasArg(const char* name) {
+    char value[1];
+    return find(name, value, sizeof(value)) != ESP_ERR_NOT_FOUND;  // Truncated still means it's there
+}
+
+String ApiRequest::arg(const char* name) {
+    char value[WIFI_HTTP_ARG_SIZE];
+    if (find(name, value, sizeof(value)) != ESP_OK) {
+        return String();
+    }
+
+    // Undo the form encoding: '+' for a space and %XX for anything else
+    char* out = value;
+    for (const char* in = value; *in; in++) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (in[0] == '%' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2])) {
+            char hex[3] = {in[1], in[2], '\0'};
+            *out++ = (char)strtol(hex, nullptr, 16);
+            in += 2;
+        } else {
+            *out++ = *in;
         }
     }
+    *out = '\0';
+    return String(value);
+}
+
+String ApiRequest::uri() {
+    String path(req->uri);
+    int query_start = path.indexOf('?');
+    return (query_start == -1) ? path : path.substring(0, query_start);
 }
 
 // Helper function to extract bus ID from URL path
@@ -149,203 +339,482 @@ int getBusIdFromPath(const String& path) {
     return path.substring(start, end).toInt();
 }
 
+// A power job as reported by POST .../power (202 Accepted) and GET /api/jobs/{id}
+static void addJobJson(JsonObject item, uint8_t bus_id, const BusJob& job) {
+    item["id"] = job.id;
+    item["bus_id"] = bus_id;
+    item["type"] = job.getTypeString();
+    item["phase"] = job.getPhaseString();
+    item["progress"] = job.progress;
+    item["finished"] = job.isFinished();
+    if (job.isFinished()) {
+        item["result"]["succeeded"] = (job.phase == JOB_COMPLETE);
+        item["result"]["repeller_count"] = job.repeller_count;
+        item["result"]["duration_ms"] = job.finished_at - job.queued_at;
+    } else {
+        item["elapsed_ms"] = millis() - job.queued_at;
+    }
+}
 
 // REST API endpoint handlers
-void handleBusStatus() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusStatus(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
-    sendJsonResponse(200, device->getBusStatusJson());
+    return sendJsonResponse(req, 200, device->getBusStatusJson());
 }
 
-void handleBusPower() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusPower(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
     // Read form data
-    if (web_server->hasArg("state")) {
-        String state_str = web_server->arg("state");
+    if (request.hasArg("state")) {
+        String state_str = request.arg("state");
         bool power_on = (state_str == "true" || state_str == "1");
         
+        // Power changes are queued as jobs and take seconds to run, so the reply is the job, to be followed at
+        // GET /api/jobs/{id}
+        uint16_t job_id;
         if (power_on) {
-            device->getBus()->ZigbeePowerOn();
-            Serial.printf("Bus %d powered ON via WiFi API\n", bus_id);
+            job_id = device->getBus()->ZigbeePowerOn();
+            Serial.printf("Bus %d power ON queued (job %u) via WiFi API\n", bus_id, job_id);
         } else {
-            device->getBus()->ZigbeePowerOff();
-            Serial.printf("Bus %d powered OFF via WiFi API\n", bus_id);
+            job_id = device->getBus()->ZigbeePowerOff();
+            Serial.printf("Bus %d power OFF queued (job %u) via WiFi API\n", bus_id, job_id);
         }
-        
-        sendJsonResponse(200, device->getBusStatusJson());
+
+        BusJob job;
+        if (!device->getBus()->find_job(job_id, job)) {
+            return sendErrorResponse(req, 503, "Job queue full");
+        }
+
+        JsonDocument doc;
+        addJobJson(doc.to<JsonObject>(), bus_id, job);
+        String output;
+        serializeJson(doc, output);
+
+        char location[24];
+        snprintf(location, sizeof(location), WIFI_JOB_PATH "%u", job_id);
+        httpd_resp_set_hdr(req, "Location", location);
+        return sendJsonResponse(req, 202, output);
     } else {
-        sendErrorResponse(400, "Missing state parameter");
+        return sendErrorResponse(req, 400, "Missing state parameter");
     }
 }
 
-void handleBusBrightness() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusBrightness(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
-    if (web_server->hasArg("value")) {
-        int brightness = web_server->arg("value").toInt();
+    if (request.hasArg("value")) {
+        int brightness = request.arg("value").toInt();
         if (brightness >= 1 && brightness <= 255) {
             // Convert HTTP API brightness (1-255) to internal brightness (0-254)
             uint8_t zigbee_brightness = brightness - 1;
-            device->getBus()->ZigbeeSetBrightness(zigbee_brightness);
-            device->getBus()->change_led_brightness(device->getBus()->repeller_brightness());  // Update LED brightness
+            device->getBus()->ZigbeeSetBrightness(zigbee_brightness);  // The bus reconciler pushes it to the repellers
             Serial.printf("Bus %d brightness set to %d via WiFi API\n", bus_id, brightness);
-            sendJsonResponse(200, device->getBusStatusJson());
+            return sendJsonResponse(req, 200, device->getBusStatusJson());
         } else {
-            sendErrorResponse(400, "Brightness must be 1-255");
+            return sendErrorResponse(req, 400, "Brightness must be 1-255");
         }
     } else {
-        sendErrorResponse(400, "Missing value parameter");
+        return sendErrorResponse(req, 400, "Missing value parameter");
     }
 }
 
-void handleBusColor() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusColor(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
-    if (web_server->hasArg("red") && web_server->hasArg("green") && web_server->hasArg("blue")) {
-        int red = web_server->arg("red").toInt();
-        int green = web_server->arg("green").toInt();
-        int blue = web_server->arg("blue").toInt();
+    if (request.hasArg("red") && request.hasArg("green") && request.hasArg("blue")) {
+        int red = request.arg("red").toInt();
+        int green = request.arg("green").toInt();
+        int blue = request.arg("blue").toInt();
         
         if (red >= 0 && red <= 255 && green >= 0 && green <= 255 && blue >= 0 && blue <= 255) {
-            device->getBus()->ZigbeeSetRGB(red, green, blue);
-            device->getBus()->change_led_color(red, green, blue);  // Update LED color
+            device->getBus()->ZigbeeSetRGB(red, green, blue);  // The bus reconciler pushes it to the repellers
             Serial.printf("Bus %d color set to RGB(%d,%d,%d) via WiFi API\n", bus_id, red, green, blue);
-            sendJsonResponse(200, device->getBusStatusJson());
+            return sendJsonResponse(req, 200, device->getBusStatusJson());
         } else {
-            sendErrorResponse(400, "RGB values must be 0-255");
+            return sendErrorResponse(req, 400, "RGB values must be 0-255");
         }
     } else {
-        sendErrorResponse(400, "Missing red, green, or blue parameters");
+        return sendErrorResponse(req, 400, "Missing red, green, or blue parameters");
     }
 }
 
-void handleBusCartridgeStatus() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusCartridgeStatus(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
-    sendJsonResponse(200, device->getCartridgeStatusJson());
+    return sendJsonResponse(req, 200, device->getCartridgeStatusJson());
 }
 
-void handleBusCartridgeReset() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusCartridgeReset(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
     device->getBus()->ZigbeeResetCartridge();
     Serial.printf("Bus %d cartridge reset via WiFi API\n", bus_id);
-    sendJsonResponse(200, device->getCartridgeStatusJson());
+    return sendJsonResponse(req, 200, device->getCartridgeStatusJson());
 }
 
-void handleBusAutoShutoff() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusRepellers(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
-    if (web_server->method() == HTTP_GET) {
+    return sendJsonResponse(req, 200, device->getRepellersJson());
+}
+
+// Hourly usage between from and to (Unix seconds, the last WIFI_HISTORY_DEFAULT_SECONDS by default). The buckets
+// are fetched and sent WIFI_HISTORY_PAGE at a time through fixed buffers, so a long range takes no more memory
+// than a short one
+esp_err_t handleBusHistory(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
+    WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
+    
+    if (!device) {
+        return sendErrorResponse(req, 404, "Bus not found");
+    }
+
+    time_t now = time(nullptr);
+    bool clock_set = now >= USAGE_HISTORY_CLOCK_VALID;
+    uint32_t to = request.hasArg("to") ? strtoul(request.arg("to").c_str(), nullptr, 10) : (uint32_t)now;
+    uint32_t from = request.hasArg("from") ? strtoul(request.arg("from").c_str(), nullptr, 10)
+                                               : (to > WIFI_HISTORY_DEFAULT_SECONDS ? to - WIFI_HISTORY_DEFAULT_SECONDS : 0);
+    if (from > to) {
+        return sendErrorResponse(req, 400, "from must not be after to");
+    }
+
+    // Only the HTTP server's task runs handlers, so these can be shared between requests
+    static UsageBucket page[WIFI_HISTORY_PAGE];
+    static char text[WIFI_HISTORY_PAGE * 96];
+
+    sendCorsHeaders(req);
+    httpd_resp_set_type(req, "application/json");  // No length set, so the chunks below are sent chunked
+
+    int length = snprintf(text, sizeof(text), "{\"bus_id\":%d,\"from\":%lu,\"to\":%lu,\"clock_set\":%s,\"buckets\":[",
+                          bus_id, (unsigned long)from, (unsigned long)to, clock_set ? "true" : "false");
+    if (httpd_resp_send_chunk(req, text, length) != ESP_OK) {
+        return ESP_FAIL;  // The client has gone; failing closes the socket
+    }
+
+    uint32_t from_hour = from / 3600;
+    uint32_t to_hour = to / 3600;
+    bool first = true;
+    while (from_hour <= to_hour) {
+        size_t count = device->getBus()->query_usage_history(from_hour, to_hour, page, WIFI_HISTORY_PAGE);
+        length = 0;
+        for (size_t i = 0; i < count; i++) {
+            length += snprintf(text + length, sizeof(text) - length,
+                               "%s{\"start\":%lu,\"active_seconds\":%lu,\"power_ons\":%u,\"auto_shutoffs\":%u}",
+                               first ? "" : ",", (unsigned long)page[i].hour * 3600, (unsigned long)page[i].active_seconds,
+                               page[i].power_ons, page[i].auto_shutoffs);
+            first = false;
+        }
+        if (length > 0 && httpd_resp_send_chunk(req, text, length) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        if (count < WIFI_HISTORY_PAGE) {
+            break;
+        }
+        from_hour = page[count - 1].hour + 1;
+    }
+
+    httpd_resp_sendstr_chunk(req, "]}");
+    return httpd_resp_send_chunk(req, nullptr, 0);  // Ends the chunked response
+}
+
+// The fields particular to each type of flash event log record, as JSON (starting with a comma)
+static int formatEventLogData(char* text, size_t size, const EventRecord& record) {
+    uint16_t value;
+    switch (record.type) {
+        case EVENT_LOG_BOOT:
+            return snprintf(text, size, ",\"reset_reason\":%d", record.data[0]);
+        case EVENT_LOG_POWER:
+            return snprintf(text, size, ",\"from\":\"%s\",\"to\":\"%s\"", bus_state_string((BusState)record.data[0]),
+                            bus_state_string((BusState)record.data[1]));
+        case EVENT_LOG_AUTO_SHUTOFF:
+            memcpy(&value, record.data, sizeof(value));
+            return snprintf(text, size, ",\"after_seconds\":%u", value);
+        case EVENT_LOG_DISCOVERY:
+            return snprintf(text, size, ",\"found\":%d", record.data[0]);
+        case EVENT_LOG_TIMEOUT:
+            return snprintf(text, size, ",\"what\":\"%s\",\"address\":%d", bus_timeout_string(record.data[0]), record.data[1]);
+        case EVENT_LOG_RESYNC:
+            memcpy(&value, &record.data[1], sizeof(value));
+            return snprintf(text, size, ",\"source\":%d,\"dropped\":%u", record.data[0], value);
+        default:
+            return 0;
+    }
+}
+
+// Records from the flash event log, oldest first. Filters: from/to (Unix seconds), type (comma-separated names),
+// bus, since (sequence number - pass back next to page through) and limit. Like the history, the records are
+// read and sent a page at a time through fixed buffers
+esp_err_t handleEventLog(httpd_req_t* req) {
+    ApiRequest request(req);
+    EventLogFilter filter;
+    filter.from = request.hasArg("from") ? strtoul(request.arg("from").c_str(), nullptr, 10) : 0;
+    filter.to = request.hasArg("to") ? strtoul(request.arg("to").c_str(), nullptr, 10) : UINT32_MAX;
+    filter.bus_id = request.hasArg("bus") ? request.arg("bus").toInt() : EVENT_LOG_SYSTEM;
+    filter.type_mask = EVENT_LOG_MASK_ALL;
+    if (request.hasArg("type")) {
+        filter.type_mask = 0;
+        String types = request.arg("type");
+        int start = 0;
+        while (start <= (int)types.length()) {
+            int end = types.indexOf(',', start);
+            if (end == -1) end = types.length();
+            uint8_t type = event_log_type_from_string(types.substring(start, end).c_str());
+            if (type == 0) {
+                return sendErrorResponse(req, 400, "Unknown event type");
+            }
+            filter.type_mask |= EVENT_LOG_MASK(type);
+            start = end + 1;
+        }
+    }
+    uint32_t since = request.hasArg("since") ? strtoul(request.arg("since").c_str(), nullptr, 10) : 0;
+    uint32_t limit = request.hasArg("limit") ? strtoul(request.arg("limit").c_str(), nullptr, 10) : WIFI_LOG_DEFAULT_LIMIT;
+
+    // Only the HTTP server's task runs handlers, so these can be shared between requests
+    static EventRecord page[WIFI_LOG_PAGE];
+    static char text[WIFI_LOG_PAGE * 160];  // The longest record comes to about 140 characters
+
+    sendCorsHeaders(req);
+    httpd_resp_set_type(req, "application/json");  // No length set, so the chunks below are sent chunked
+    if (httpd_resp_sendstr_chunk(req, "{\"events\":[") != ESP_OK) {
+        return ESP_FAIL;  // The client has gone; failing closes the socket
+    }
+
+    uint32_t sent = 0;
+    uint32_t next = since;
+    while (sent < limit) {
+        size_t want = (limit - sent < WIFI_LOG_PAGE) ? limit - sent : WIFI_LOG_PAGE;
+        size_t count = flash_event_log.query(filter, next, page, want);
+        int length = 0;
+        for (size_t i = 0; i < count; i++) {
+            const EventRecord& record = page[i];
+            length += snprintf(text + length, sizeof(text) - length,
+                               "%s{\"sequence\":%lu,\"time\":%lu,\"uptime\":%s,\"type\":\"%s\"",
+                               sent == 0 ? "" : ",", (unsigned long)record.sequence, (unsigned long)record.time,
+                               (record.flags & EVENT_LOG_UPTIME) ? "true" : "false", event_log_type_string(record.type));
+            if (record.bus_id != EVENT_LOG_SYSTEM) {
+                length += snprintf(text + length, sizeof(text) - length, ",\"bus_id\":%d", record.bus_id);
+            }
+            length += formatEventLogData(text + length, sizeof(text) - length, record);
+            length += snprintf(text + length, sizeof(text) - length, "}");
+            next = record.sequence + 1;
+            sent++;
+        }
+        if (length > 0 && httpd_resp_send_chunk(req, text, length) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        if (count < want) {
+            break;
+        }
+    }
+
+    int length = snprintf(text, sizeof(text), "],\"next\":%lu,\"clock_set\":%s}", (unsigned long)next,
+                          time(nullptr) >= USAGE_HISTORY_CLOCK_VALID ? "true" : "false");
+    httpd_resp_send_chunk(req, text, length);
+    return httpd_resp_send_chunk(req, nullptr, 0);  // Ends the chunked response
+}
+
+// Every repeller in the ledger, including ones not on either bus at the moment
+esp_err_t handleRepellers(httpd_req_t* req) {
+    JsonDocument doc;
+    JsonArray list = doc["repellers"].to<JsonArray>();
+    RepellerLedgerEntry entry;
+    uint16_t count = 0;
+    for (; repeller_ledger.getEntry(count, entry); count++) {
+        JsonObject item = list.add<JsonObject>();
+        item["serial"] = entry.serial;
+        item["active_seconds"] = entry.active_seconds;
+        item["runtime_hours"] = entry.active_seconds / 3600;
+        item["last_bus"] = entry.last_bus;
+    }
+    doc["count"] = count;
+    doc["capacity"] = REPELLER_LEDGER_MAX_ENTRIES;
+    doc["full"] = count >= REPELLER_LEDGER_MAX_ENTRIES;  // A new serial now replaces the one seen longest ago
+    doc["evictions"] = repeller_ledger.getEvictions();
+    doc["flushes"] = repeller_ledger.getFlushes();
+
+    String output;
+    serializeJson(doc, output);
+    return sendJsonResponse(req, 200, output);
+}
+
+esp_err_t handleRepellerReset(httpd_req_t* req) {
+    ApiRequest request(req);
+    if (!request.hasArg("serial")) {
+        return sendErrorResponse(req, 400, "Missing serial parameter");
+    }
+
+    String serial = request.arg("serial");
+    if (!repeller_ledger.reset(serial.c_str())) {
+        return sendErrorResponse(req, 404, "Repeller not found");
+    }
+
+    Serial.printf("Repeller %s cartridge reset via WiFi API\n", serial.c_str());
+    JsonDocument doc;
+    doc["serial"] = serial;
+    doc["active_seconds"] = 0;
+
+    String output;
+    serializeJson(doc, output);
+    return sendJsonResponse(req, 200, output);
+}
+
+esp_err_t handleBusAutoShutoff(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
+    WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
+    
+    if (!device) {
+        return sendErrorResponse(req, 404, "Bus not found");
+    }
+    
+    if (req->method == HTTP_GET) {
         JsonDocument doc;
         doc["bus_id"] = bus_id;
-        doc["auto_shutoff_minutes"] = device->getBus()->get_auto_shut_off_after_seconds() / 60;
+        doc["auto_shutoff_minutes"] = device->getBus()->get_snapshot().auto_shut_off_after_seconds / 60;
         
         String output;
         serializeJson(doc, output);
-        sendJsonResponse(200, output);
-    } else if (web_server->method() == HTTP_POST) {
-        if (web_server->hasArg("minutes")) {
-            int minutes = web_server->arg("minutes").toInt();
+        return sendJsonResponse(req, 200, output);
+    } else if (req->method == HTTP_POST) {
+        if (request.hasArg("minutes")) {
+            int minutes = request.arg("minutes").toInt();
             
             if (minutes >= 0 && minutes <= 960) {
                 int seconds = minutes * 60;
                 device->getBus()->ZigbeeSetAutoShutOffAfterSeconds(seconds);
                 Serial.printf("Bus %d auto shutoff set to %d minutes (%d seconds) via WiFi API\n", bus_id, minutes, seconds);
-                sendJsonResponse(200, device->getCartridgeStatusJson());
+                return sendJsonResponse(req, 200, device->getCartridgeStatusJson());
             } else {
-                sendErrorResponse(400, "Auto shutoff must be 0-960 minutes");
+                return sendErrorResponse(req, 400, "Auto shutoff must be 0-960 minutes");
             }
         } else {
-            sendErrorResponse(400, "Missing minutes parameter");
+            return sendErrorResponse(req, 400, "Missing minutes parameter");
         }
     } else {
-        sendErrorResponse(405, "Method not allowed");
+        return sendErrorResponse(req, 405, "Method not allowed");
     }
 }
 
 
 
-void handleBusCartridgeWarnAt() {
-    int bus_id = getBusIdFromPath(web_server->uri());
+esp_err_t handleBusCartridgeWarnAt(httpd_req_t* req) {
+    ApiRequest request(req);
+    int bus_id = getBusIdFromPath(request.uri());
     WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
     
     if (!device) {
-        sendErrorResponse(404, "Bus not found");
-        return;
+        return sendErrorResponse(req, 404, "Bus not found");
     }
     
-    if (web_server->method() == HTTP_GET) {
+    if (req->method == HTTP_GET) {
         JsonDocument doc;
         doc["bus_id"] = bus_id;
-        doc["warn_at_hours"] = device->getBus()->get_cartridge_warn_at_seconds() / 3600;
+        doc["warn_at_hours"] = device->getBus()->get_snapshot().cartridge_warn_at_seconds / 3600;
         
         String output;
         serializeJson(doc, output);
-        sendJsonResponse(200, output);
-    } else if (web_server->method() == HTTP_POST) {
-        if (web_server->hasArg("hours")) {
-            int hours = web_server->arg("hours").toInt();
+        return sendJsonResponse(req, 200, output);
+    } else if (req->method == HTTP_POST) {
+        if (request.hasArg("hours")) {
+            int hours = request.arg("hours").toInt();
             if (hours >= 0) {
                 uint32_t seconds = hours * 3600;
                 device->getBus()->ZigbeeSetCartridgeWarnAtSeconds(seconds);
                 Serial.printf("Bus %d cartridge warn threshold set to %d hours via WiFi API\n", bus_id, hours);
-                sendJsonResponse(200, device->getCartridgeStatusJson());
+                return sendJsonResponse(req, 200, device->getCartridgeStatusJson());
             } else {
-                sendErrorResponse(400, "Hours must be >= 0");
+                return sendErrorResponse(req, 400, "Hours must be >= 0");
             }
         } else {
-            sendErrorResponse(400, "Missing hours parameter");
+            return sendErrorResponse(req, 400, "Missing hours parameter");
         }
+    } else {
+        return sendErrorResponse(req, 405, "Method not allowed");
     }
 }
 
 
 
-void handleSystemStatus() {
+esp_err_t handleSystemPower(httpd_req_t* req) {
+    ApiRequest request(req);
+    if (!request.hasArg("state")) {
+        return sendErrorResponse(req, 400, "Missing state parameter");
+    }
+
+    String state_str = request.arg("state");
+    bool power_on = (state_str == "true" || state_str == "1");
+
+    // Both buses are sequenced together so their power-up waits overlap. There is a job per bus
+    uint16_t job_ids[BUS_ARBITER_MAX_BUSES] = {};
+    if (power_on) {
+        bus_arbiter.power_on_all(job_ids);
+        Serial.println("All buses power ON queued via WiFi API");
+    } else {
+        bus_arbiter.power_off_all(job_ids);
+        Serial.println("All buses power OFF queued via WiFi API");
+    }
+
+    JsonDocument doc;
+    JsonArray jobs = doc["jobs"].to<JsonArray>();
+    for (uint8_t bus_id = 0; bus_id < bus_arbiter.getBusCount(); bus_id++) {
+        WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
+        BusJob job;
+        if (device && device->getBus()->find_job(job_ids[bus_id], job)) {
+            addJobJson(jobs.add<JsonObject>(), bus_id, job);
+        }
+    }
+
+    String output;
+    serializeJson(doc, output);
+    return sendJsonResponse(req, 202, output);
+}
+
+esp_err_t handleSystemStatus(httpd_req_t* req) {
     // Return combined system status
     JsonDocument doc;
     
@@ -362,18 +831,145 @@ void handleSystemStatus() {
     doc["uptime_ms"] = millis();
     
     // Add bus statuses
-    doc["bus0"]["state"] = bus0.getStateString();
-    doc["bus0"]["repeller_count"] = bus0.getRepellers().size();
-    doc["bus1"]["state"] = bus1.getStateString();
-    doc["bus1"]["repeller_count"] = bus1.getRepellers().size();
+    BusSnapshot bus0_snapshot = bus0.get_snapshot();
+    BusSnapshot bus1_snapshot = bus1.get_snapshot();
+    doc["bus0"]["state"] = bus_state_string(bus0_snapshot.state);
+    doc["bus0"]["repeller_count"] = bus0_snapshot.repeller_count;
+    doc["bus1"]["state"] = bus_state_string(bus1_snapshot.state);
+    doc["bus1"]["repeller_count"] = bus1_snapshot.repeller_count;
+    doc["bus0"]["command_latency_ms"]["p50"] = bus0_snapshot.command_latency_p50_ms;
+    doc["bus0"]["command_latency_ms"]["p99"] = bus0_snapshot.command_latency_p99_ms;
+    doc["bus1"]["command_latency_ms"]["p50"] = bus1_snapshot.command_latency_p50_ms;
+    doc["bus1"]["command_latency_ms"]["p99"] = bus1_snapshot.command_latency_p99_ms;
+
+    // Power management (see PowerManager). bus_active_ms is time spent holding a wire, i.e. at full clock
+    PowerStats power = power_manager.getStats();
+    doc["power"]["enabled"] = power.enabled;
+    doc["power"]["light_sleep"] = power.light_sleep;
+    doc["power"]["cpu_mhz"]["current"] = power.current_freq_mhz;
+    doc["power"]["cpu_mhz"]["min"] = power.min_freq_mhz;
+    doc["power"]["cpu_mhz"]["max"] = power.max_freq_mhz;
+    doc["power"]["bus_active_ms"] = power.bus_active_us / 1000;
+    doc["power"]["bus_transactions"] = power.bus_transactions;
+    if (power.asleep_us >= 0) {
+        doc["power"]["asleep_ms"] = power.asleep_us / 1000;
+        doc["power"]["sleep_count"] = power.sleep_count;
+        doc["power"]["asleep_percent"] = power.uptime_us ? power.asleep_us * 100.0 / power.uptime_us : 0.0;
+    }
     
     String output;
     serializeJson(doc, output);
-    sendJsonResponse(200, output);
+    return sendJsonResponse(req, 200, output);
+}
+
+// Bus events with a sequence number of at least ?since=N, oldest first. Clients poll with the "next" value from
+// the previous response; if "resync" is set, events were missed and the status endpoints should be re-read.
+esp_err_t handleEvents(httpd_req_t* req) {
+    ApiRequest request(req);
+    uint32_t since = request.hasArg("since") ? strtoul(request.arg("since").c_str(), nullptr, 10) : 0;
+
+    // The loop task fills the ring while handlers run, so work from a copy
+    static BusEvent events_copy[WIFI_EVENT_LOG_SIZE];
+    portENTER_CRITICAL(&event_log_mux);
+    uint32_t count = event_log_count;
+    uint32_t resync_before = event_log_resync_before;
+    memcpy(events_copy, event_log, sizeof(events_copy));
+    portEXIT_CRITICAL(&event_log_mux);
+
+    uint32_t kept = count < WIFI_EVENT_LOG_SIZE ? count : WIFI_EVENT_LOG_SIZE;
+    uint32_t first = count - kept;
+    uint32_t next = since;
+
+    JsonDocument doc;
+    JsonArray events = doc["events"].to<JsonArray>();
+    for (uint32_t i = first; i < count; i++) {
+        const BusEvent& event = events_copy[i % WIFI_EVENT_LOG_SIZE];
+        if (event.sequence < since) {
+            continue;
+        }
+
+        JsonObject entry = events.add<JsonObject>();
+        entry["sequence"] = event.sequence;
+        entry["at_ms"] = event.at;
+        entry["bus_id"] = event.bus_id;
+        entry["type"] = event.getTypeString();
+        switch (event.type) {
+            case BUS_EVENT_STATE_CHANGED:
+                entry["from"] = bus_state_string((BusState)event.state.from);
+                entry["to"] = bus_state_string((BusState)event.state.to);
+                break;
+            case BUS_EVENT_REPELLER_CHANGED:
+                entry["address"] = event.repeller.address;
+                entry["from"] = repeller_state_string((RepellerState)event.repeller.from);
+                entry["to"] = repeller_state_string((RepellerState)event.repeller.to);
+                break;
+            case BUS_EVENT_SETTINGS_CHANGED:
+                entry["setting"] = bus_setting_string(event.setting);
+                break;
+            case BUS_EVENT_CARTRIDGE_THRESHOLD:
+                entry["threshold"] = event.cartridge.threshold;
+                entry["percent_left"] = event.cartridge.percent_left;
+                break;
+            case BUS_EVENT_AUTO_SHUTOFF:
+                entry["after_seconds"] = event.auto_shutoff_seconds;
+                break;
+            case BUS_EVENT_DISCOVERY:
+                entry["found"] = event.found;
+                break;
+            case BUS_EVENT_TIMEOUT:
+                entry["what"] = bus_timeout_string(event.timeout.what);
+                entry["address"] = event.timeout.address;
+                break;
+        }
+        next = event.sequence + 1;
+    }
+
+    uint32_t oldest_kept = kept > 0 ? events_copy[first % WIFI_EVENT_LOG_SIZE].sequence : bus_events.getPublishedCount();
+    doc["next"] = next;
+    doc["resync"] = since < resync_before || since < oldest_kept;
+
+    String output;
+    serializeJson(doc, output);
+    return sendJsonResponse(req, 200, output);
 }
 
-void handleNotFound() {
-    sendErrorResponse(404, "Endpoint not found");
+// A power job by the ID it was given when queued: its phase and progress while it runs, and its result once it
+// has finished (for as long as it is one of the last BUS_JOB_HISTORY on its bus)
+esp_err_t handleJob(httpd_req_t* req) {
+    ApiRequest request(req);
+    String id_text = request.uri().substring(strlen(WIFI_JOB_PATH));
+    char* end;
+    unsigned long id = strtoul(id_text.c_str(), &end, 10);
+    if (id_text.length() == 0 || *end != '\0' || id == 0 || id > UINT16_MAX) {
+        return sendErrorResponse(req, 400, "Invalid job ID");
+    }
+
+    for (uint8_t bus_id = 0; bus_id < bus_arbiter.getBusCount(); bus_id++) {
+        WiFiRepellerDevice* device = getDeviceByBusId(bus_id);
+        BusJob job;
+        if (device && device->getBus()->find_job(id, job)) {
+            JsonDocument doc;
+            addJobJson(doc.to<JsonObject>(), bus_id, job);
+            String output;
+            serializeJson(doc, output);
+            return sendJsonResponse(req, 200, output);
+        }
+    }
+    return sendErrorResponse(req, 404, "Job not found");
+}
+
+esp_err_t handleCorsPreflight(httpd_req_t* req) {
+    sendCorsHeaders(req);
+    httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_send(req, "", 0);
+}
+
+// Requests no route matched: an unknown path, or a known one with the wrong method
+esp_err_t handleNotFound(httpd_req_t* req, httpd_err_code_t error) {
+    if (error == HTTPD_405_METHOD_NOT_ALLOWED) {
+        return sendErrorResponse(req, 405, "Method not allowed");
+    }
+    return sendErrorResponse(req, 404, "Endpoint not found");
 }
 
 // Helper functions
@@ -383,62 +979,94 @@ WiFiRepellerDevice* getDeviceByBusId(uint8_t bus_id) {
     return nullptr;
 }
 
+static void addRoute(const char* uri, httpd_method_t method, esp_err_t (*handler)(httpd_req_t* req)) {
+    httpd_uri_t route = {};
+    route.uri = uri;
+    route.method = method;
+    route.handler = handler;
+    if (httpd_register_uri_handler(web_server, &route) != ESP_OK) {
+        Serial.printf("Failed to register %s (raise WIFI_HTTP_MAX_HANDLERS?)\n", uri);
+    }
+}
+
 void setupWebServerRoutes() {
     // Bus 0 control endpoints
-    web_server->on("/api/bus/0/status", HTTP_GET, handleBusStatus);
-    web_server->on("/api/bus/0/power", HTTP_POST, handleBusPower);
-    web_server->on("/api/bus/0/brightness", HTTP_POST, handleBusBrightness);
-    web_server->on("/api/bus/0/color", HTTP_POST, handleBusColor);
-    web_server->on("/api/bus/0/cartridge", HTTP_GET, handleBusCartridgeStatus);
-    web_server->on("/api/bus/0/cartridge/reset", HTTP_POST, handleBusCartridgeReset);
-    web_server->on("/api/bus/0/auto_shutoff", HTTP_GET, handleBusAutoShutoff);
-    web_server->on("/api/bus/0/auto_shutoff", HTTP_POST, handleBusAutoShutoff);
-    web_server->on("/api/bus/0/warn_at", HTTP_GET, handleBusCartridgeWarnAt);
-    web_server->on("/api/bus/0/warn_at", HTTP_POST, handleBusCartridgeWarnAt);
+    addRoute("/api/bus/0/status", HTTP_GET, handleBusStatus);
+    addRoute("/api/bus/0/power", HTTP_POST, handleBusPower);
+    addRoute("/api/bus/0/brightness", HTTP_POST, handleBusBrightness);
+    addRoute("/api/bus/0/color", HTTP_POST, handleBusColor);
+    addRoute("/api/bus/0/cartridge", HTTP_GET, handleBusCartridgeStatus);
+    addRoute("/api/bus/0/cartridge/reset", HTTP_POST, handleBusCartridgeReset);
+    addRoute("/api/bus/0/auto_shutoff", HTTP_GET, handleBusAutoShutoff);
+    addRoute("/api/bus/0/auto_shutoff", HTTP_POST, handleBusAutoShutoff);
+    addRoute("/api/bus/0/warn_at", HTTP_GET, handleBusCartridgeWarnAt);
+    addRoute("/api/bus/0/warn_at", HTTP_POST, handleBusCartridgeWarnAt);
+    addRoute("/api/bus/0/repellers", HTTP_GET, handleBusRepellers);
+    addRoute("/api/bus/0/history", HTTP_GET, handleBusHistory);
     
     // Bus 1 control endpoints
-    web_server->on("/api/bus/1/status", HTTP_GET, handleBusStatus);
-    web_server->on("/api/bus/1/power", HTTP_POST, handleBusPower);
-    web_server->on("/api/bus/1/brightness", HTTP_POST, handleBusBrightness);
-    web_server->on("/api/bus/1/color", HTTP_POST, handleBusColor);
-    web_server->on("/api/bus/1/cartridge", HTTP_GET, handleBusCartridgeStatus);
-    web_server->on("/api/bus/1/cartridge/reset", HTTP_POST, handleBusCartridgeReset);
-    web_server->on("/api/bus/1/auto_shutoff", HTTP_GET, handleBusAutoShutoff);
-    web_server->on("/api/bus/1/auto_shutoff", HTTP_POST, handleBusAutoShutoff);
-    web_server->on("/api/bus/1/warn_at", HTTP_GET, handleBusCartridgeWarnAt);
-    web_server->on("/api/bus/1/warn_at", HTTP_POST, handleBusCartridgeWarnAt);
+    addRoute("/api/bus/1/status", HTTP_GET, handleBusStatus);
+    addRoute("/api/bus/1/power", HTTP_POST, handleBusPower);
+    addRoute("/api/bus/1/brightness", HTTP_POST, handleBusBrightness);
+    addRoute("/api/bus/1/color", HTTP_POST, handleBusColor);
+    addRoute("/api/bus/1/cartridge", HTTP_GET, handleBusCartridgeStatus);
+    addRoute("/api/bus/1/cartridge/reset", HTTP_POST, handleBusCartridgeReset);
+    addRoute("/api/bus/1/auto_shutoff", HTTP_GET, handleBusAutoShutoff);
+    addRoute("/api/bus/1/auto_shutoff", HTTP_POST, handleBusAutoShutoff);
+    addRoute("/api/bus/1/warn_at", HTTP_GET, handleBusCartridgeWarnAt);
+    addRoute("/api/bus/1/warn_at", HTTP_POST, handleBusCartridgeWarnAt);
+    addRoute("/api/bus/1/repellers", HTTP_GET, handleBusRepellers);
+    addRoute("/api/bus/1/history", HTTP_GET, handleBusHistory);
     
     // System endpoints
-    web_server->on("/api/system/status", HTTP_GET, handleSystemStatus);
-    
-    // Handle OPTIONS requests for CORS and 404s
-    web_server->onNotFound([]() {
-        if (web_server->method() == HTTP_OPTIONS) {
-            web_server->sendHeader("Access-Control-Allow-Origin", "*");
-            web_server->sendHeader("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
-            web_server->sendHeader("Access-Control-Allow-Headers", "Content-Type");
-            web_server->send(200, "text/plain", "");
-        } else {
-            handleNotFound();
-        }
-    });
+    addRoute("/api/system/status", HTTP_GET, handleSystemStatus);
+    addRoute("/api/system/power", HTTP_POST, handleSystemPower);
+    addRoute("/api/events", HTTP_GET, handleEvents);
+    addRoute("/api/log", HTTP_GET, handleEventLog);
+    addRoute("/api/repellers", HTTP_GET, handleRepellers);
+    addRoute("/api/repellers/reset", HTTP_POST, handleRepellerReset);
+    addRoute(WIFI_JOB_PATH "*", HTTP_GET, handleJob);
+    
+    // Handle OPTIONS requests for CORS, and reply to anything unmatched in JSON like the rest of the API
+    addRoute("/*", HTTP_OPTIONS, handleCorsPreflight);
+    httpd_register_err_handler(web_server, HTTPD_404_NOT_FOUND, handleNotFound);
+    httpd_register_err_handler(web_server, HTTPD_405_METHOD_NOT_ALLOWED, handleNotFound);
     
     Serial.println("Web server routes configured");
 }
 
-void sendJsonResponse(int status_code, const String& json) {
-    web_server->sendHeader("Access-Control-Allow-Origin", "*");
-    web_server->sendHeader("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
-    web_server->sendHeader("Access-Control-Allow-Headers", "Content-Type");
-    web_server->send(status_code, "application/json", json);
+// The status line httpd_resp_set_status() wants (it keeps the pointer, so these have to be literals)
+static const char* http_status_string(int status_code) {
+    switch (status_code) {
+        case 200: return "200 OK";
+        case 202: return "202 Accepted";
+        case 400: return "400 Bad Request";
+        case 404: return "404 Not Found";
+        case 405: return "405 Method Not Allowed";
+        case 503: return "503 Service Unavailable";
+        default: return "500 Internal Server Error";
+    }
 }
 
-void sendErrorResponse(int status_code, const String& error_message) {
+void sendCorsHeaders(httpd_req_t* req) {
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "Content-Type");
+}
+
+esp_err_t sendJsonResponse(httpd_req_t* req, int status_code, const String& json) {
+    sendCorsHeaders(req);
+    httpd_resp_set_status(req, http_status_string(status_code));
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json.c_str(), json.length());
+}
+
+esp_err_t sendErrorResponse(httpd_req_t* req, int status_code, const String& error_message) {
     JsonDocument doc;
     doc["error"] = error_message;
     doc["status"] = status_code;
     
     String output;
     serializeJson(doc, output);
-    sendJsonResponse(status_code, output);
-}
\ No newline at end of file
+    return sendJsonResponse(req, status_code, output);
+}
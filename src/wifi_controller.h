@@ -4,10 +4,13 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <WiFiManager.h>
-#include <WebServer.h>
+#include <esp_http_server.h>
 #include <ESPmDNS.h>
 #include <ArduinoJson.h>
 #include "bus.h"
+#include "bus_arbiter.h"
+#include "power_manager.h"
+#include "event_log.h"
 #include "getGuid.h"
 
 // WiFi Configuration
@@ -15,6 +18,20 @@
 #define WIFI_AP_PASSWORD "repelbridge"
 #define WIFI_MDNS_SERVICE "_repelbridge"
 #define WIFI_WEB_PORT 80
+#define WIFI_EVENT_LOG_SIZE 32  // Bus events kept for GET /api/events
+#define WIFI_HTTP_TASK_PRIORITY 1     // The HTTP server's task. Below the bus workers, like loop()
+#define WIFI_HTTP_STACK_SIZE 8192     // Handlers build their JSON on the heap, but ApiRequest's buffers are on the stack
+#define WIFI_HTTP_MAX_HANDLERS 40     // URI handlers (each bus's endpoints are registered separately)
+#define WIFI_HTTP_MAX_SOCKETS 7       // Concurrent connections; the least recently used is closed for a new one
+#define WIFI_HTTP_QUERY_SIZE 256      // Longest query string or form body read, including the terminator
+#define WIFI_HTTP_ARG_SIZE 64         // Longest single argument value
+#define WIFI_RECONNECT_RETRY_MS 5000  // Retry interval while the station stays disconnected
+#define WIFI_NTP_SERVER "pool.ntp.org"  // Sets the clock the usage history buckets are timed by
+#define WIFI_HISTORY_DEFAULT_SECONDS (7 * 24 * 3600)  // Range of GET /api/bus/N/history without from
+#define WIFI_HISTORY_PAGE 24          // Buckets fetched from the bus (and sent) at a time
+#define WIFI_LOG_PAGE 32              // Flash event log records fetched (and sent) at a time
+#define WIFI_LOG_DEFAULT_LIMIT 100    // Records returned by GET /api/log without limit
+#define WIFI_JOB_PATH "/api/jobs/"    // GET WIFI_JOB_PATH{id} reports a power job
 
 // External references to global bus objects
 extern Bus bus0;
@@ -40,6 +57,7 @@ public:
     // REST API response generators
     String getBusStatusJson();
     String getCartridgeStatusJson();
+    String getRepellersJson();
     String getSystemStatusJson();
 };
 
@@ -47,25 +65,54 @@ public:
 extern WiFiRepellerDevice* wifi_bus0_device;
 extern WiFiRepellerDevice* wifi_bus1_device;
 
-// Global web server instance
-extern WebServer* web_server;
+// The query string and form body of a request, read up front so handlers can look arguments up by name from
+// either one
+class ApiRequest {
+private:
+    httpd_req_t* req;
+    char query[WIFI_HTTP_QUERY_SIZE];
+    char body[WIFI_HTTP_QUERY_SIZE];
+
+    esp_err_t find(const char* name, char* value, size_t size);  // Looks in the query string, then the body
+
+public:
+    ApiRequest(httpd_req_t* request);
+
+    bool hasArg(const char* name);
+    String arg(const char* name);  // URL-decoded, or empty if missing
+    String uri();                  // Without the query string
+};
+
+// Global web server instance (esp_http_server, which runs the handlers below in its own task)
+extern httpd_handle_t web_server;
 
-// REST API endpoint handlers
-void handleBusStatus();
-void handleBusPower();
-void handleBusBrightness();
-void handleBusColor();
-void handleBusCartridgeStatus();
-void handleBusCartridgeReset();
-void handleBusAutoShutoff();
-void handleBusCartridgeWarnAt();
-void handleSystemStatus();
-void handleNotFound();
+// REST API endpoint handlers. They run in the HTTP server's task, so they only read bus snapshots and post
+// commands, and never wait on a bus
+esp_err_t handleBusStatus(httpd_req_t* req);
+esp_err_t handleBusPower(httpd_req_t* req);
+esp_err_t handleBusBrightness(httpd_req_t* req);
+esp_err_t handleBusColor(httpd_req_t* req);
+esp_err_t handleBusCartridgeStatus(httpd_req_t* req);
+esp_err_t handleBusCartridgeReset(httpd_req_t* req);
+esp_err_t handleBusAutoShutoff(httpd_req_t* req);
+esp_err_t handleBusCartridgeWarnAt(httpd_req_t* req);
+esp_err_t handleBusRepellers(httpd_req_t* req);
+esp_err_t handleBusHistory(httpd_req_t* req);
+esp_err_t handleRepellers(httpd_req_t* req);
+esp_err_t handleRepellerReset(httpd_req_t* req);
+esp_err_t handleSystemStatus(httpd_req_t* req);
+esp_err_t handleSystemPower(httpd_req_t* req);
+esp_err_t handleEvents(httpd_req_t* req);
+esp_err_t handleEventLog(httpd_req_t* req);
+esp_err_t handleJob(httpd_req_t* req);
+esp_err_t handleCorsPreflight(httpd_req_t* req);
+esp_err_t handleNotFound(httpd_req_t* req, httpd_err_code_t error);
 
 // Helper functions
 WiFiRepellerDevice* getDeviceByBusId(uint8_t bus_id);
 void setupWebServerRoutes();
-void sendJsonResponse(int status_code, const String& json);
-void sendErrorResponse(int status_code, const String& error_message);
+void sendCorsHeaders(httpd_req_t* req);
+esp_err_t sendJsonResponse(httpd_req_t* req, int status_code, const String& json);
+esp_err_t sendErrorResponse(httpd_req_t* req, int status_code, const String& error_message);
 
 #endif // WIFI_CONTROLLER_H
\ No newline at end of file
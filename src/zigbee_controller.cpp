@@ -10,6 +10,9 @@
 ZigbeeRepellerDevice* zigbee_bus0_device = nullptr;
 ZigbeeRepellerDevice* zigbee_bus1_device = nullptr;
 
+// Bus changes that affect the light attributes (power, color, brightness). Queuing one wakes loop()
+static BusEventQueue* zigbee_events = nullptr;
+
 // ZigbeeRepellerDevice implementation
 ZigbeeRepellerDevice::ZigbeeRepellerDevice(uint8_t ep_id, Bus* bus) 
   : endpoint_id(ep_id), controlled_bus(bus), zigbee_light(nullptr) {
@@ -94,6 +97,8 @@ void zigbee_controller_setup() {
   Zigbee.setRebootOpenNetwork(180); // Keep network open for 3 minutes after reboot
   
   Serial.println("Zigbee controller setup completed, initializing bus values");
+  zigbee_events = bus_events.subscribe(BUS_EVENT_MASK(BUS_EVENT_STATE_CHANGED) | BUS_EVENT_MASK(BUS_EVENT_SETTINGS_CHANGED),
+                                       xTaskGetCurrentTaskHandle());  // setup() and loop() share a task
   update_zigbee_attributes_from_bus(zigbee_bus0_device);
   update_zigbee_attributes_from_bus(zigbee_bus1_device);
   Serial.println("Bus values initialized. Zigbee endpoints ready.");
@@ -102,31 +107,35 @@ void zigbee_controller_setup() {
 }
 
 void zigbee_controller_loop() {
-  static unsigned long last_update = 0;
-  unsigned long current_time = millis();
-  
-  // Update Zigbee attributes every 5 seconds
-  if (current_time - last_update > 5000) {
-    update_zigbee_attributes_from_bus(zigbee_bus0_device);
-    update_zigbee_attributes_from_bus(zigbee_bus1_device);
-    
-    // Save active seconds for both buses
-    // TODO - Figure out how I want to handle this
-    // bus0.save_active_seconds();
-    // bus1.save_active_seconds();
-    
-    // Check for automatic shutoff
-    if (bus0.past_automatic_shutoff() && bus0.getState() == BUS_REPELLING) {
-      Serial.println("Bus 0: Auto shutoff triggered");
-      bus0.ZigbeePowerOff();
+  // The Zigbee stack and the buses run in their own tasks, so there is nothing to do until a bus publishes
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+  // Only touch the attributes of a bus that has published a change. If events were dropped, resync both
+  bool update_bus0 = false;
+  bool update_bus1 = false;
+
+  if (zigbee_events) {
+    if (zigbee_events->take_overflow()) {
+      update_bus0 = true;
+      update_bus1 = true;
+      log_resync_to_flash(EVENT_LOG_SOURCE_ZIGBEE, zigbee_events->getDropped());
     }
-    
-    if (bus1.past_automatic_shutoff() && bus1.getState() == BUS_REPELLING) {
-      Serial.println("Bus 1: Auto shutoff triggered");
-      bus1.ZigbeePowerOff();
+
+    BusEvent event;
+    while (zigbee_events->pop(event)) {
+      if (event.bus_id == 0) {
+        update_bus0 = true;
+      } else {
+        update_bus1 = true;
+      }
     }
-    
-    last_update = current_time;
+  }
+
+  if (update_bus0) {
+    update_zigbee_attributes_from_bus(zigbee_bus0_device);
+  }
+  if (update_bus1) {
+    update_zigbee_attributes_from_bus(zigbee_bus1_device);
   }
 }
 
@@ -141,28 +150,15 @@ void zigbee_light_change_callback(ZigbeeRepellerDevice* device, bool state, uint
   Serial.printf("Bus %d: Light change - State: %s, RGB: (%d,%d,%d), Level: %d\n", 
                 bus->getBusId(), state ? "ON" : "OFF", red, green, blue, level);
   
-  if(bus->getState() == BUS_OFFLINE || bus->getState() == BUS_POWERED) {
-    // If the bus is offline or powered but not warming up/repelling, we need to power it on
-    if(state) {
-      Serial.println("Powering bus on...");
-      bus->ZigbeePowerOn();
-    }
-  } else {
-    if(!state) {
-      Serial.println("Turning bus off...");
-      // If the bus is already warming up or repelling, we can just turn it off
-      bus->ZigbeePowerOff();
-    }
-  }
-
+  // Only record the desired state here - the bus reconciler (in the bus's worker task) powers the bus
+  // on or off and pushes brightness/color to the repellers, the same way it does for the WiFi API
+  bus->set_desired_power(state);
   
   // Set brightness (convert from Zigbee 0-254 to internal 0-254 scale)
   bus->ZigbeeSetBrightness(level);
   
   // Set RGB color directly
   bus->ZigbeeSetRGB(red, green, blue);
-
-  // TODO - Actually make this update the brightness and color on the device, not just saving it (which is what the above does)
 }
 
 
@@ -202,11 +198,11 @@ esp_err_t zigbee_custom_cluster_read_callback(uint8_t endpoint, uint16_t cluster
   
   if (cluster_id == CLUSTER_ID_CUSTOM_MANUFACTURER) {
     if (attribute_id == ATTR_ID_RUNTIME_HOURS && max_len >= sizeof(uint16_t)) {
-      uint16_t runtime_hours = device->getBus()->get_cartridge_runtime_hours();
+      uint16_t runtime_hours = device->getBus()->get_snapshot().cartridge_runtime_hours;
       memcpy(data, &runtime_hours, sizeof(uint16_t));
       return ESP_OK;
     } else if (attribute_id == ATTR_ID_PERCENT_LEFT && max_len >= sizeof(uint8_t)) {
-      uint8_t percent_left = device->getBus()->get_cartridge_percent_left();
+      uint8_t percent_left = device->getBus()->get_snapshot().cartridge_percent_left;
       memcpy(data, &percent_left, sizeof(uint8_t));
       return ESP_OK;
     }
@@ -238,13 +234,16 @@ void update_zigbee_attributes_from_bus(ZigbeeRepellerDevice* device) {
   
   Bus* bus = device->getBus();
   ZigbeeColorDimmableLight* light = device->getZigbeeLight();
+  BusSnapshot snapshot = bus->get_snapshot();
   
   // Update all light attributes using the comprehensive setLight method
-  bool is_on = (bus->getState() != BUS_OFFLINE && bus->getState() != BUS_ERROR);
-  uint8_t brightness_254 = bus->repeller_brightness() * 254 / 100; // Convert 0-100 to 0-254
-  uint8_t red = bus->repeller_red();
-  uint8_t green = bus->repeller_green();
-  uint8_t blue = bus->repeller_blue();
+  // Report the desired power state so the light doesn't flicker off while a power-on job is still running
+  bool is_on = snapshot.desired_power && snapshot.state != BUS_ERROR;
+  uint8_t repeller_brightness = (uint8_t)round((snapshot.brightness * 100.0) / 254.0);
+  uint8_t brightness_254 = repeller_brightness * 254 / 100; // Convert 0-100 to 0-254
+  uint8_t red = snapshot.red;
+  uint8_t green = snapshot.green;
+  uint8_t blue = snapshot.blue;
   
   if(light->getLightState() != is_on) {
     changed = true;
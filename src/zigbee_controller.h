@@ -12,6 +12,8 @@
 #include "ZBCDL.h"  // Include the near clone of ZigbeeColorDimmableLight.h
 
 #include "bus.h"
+#include "bus_arbiter.h"
+#include "event_log.h"
 
 // Zigbee Configuration
 #define ZIGBEE_MANUFACTURER_CODE 0x1234
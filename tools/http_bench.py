@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""Concurrent-client benchmark for the RepelBridge REST API (WiFi controller mode).
+
+Each client is a thread with its own HTTP connection that requests the given paths in turn for the length of
+the run, the way several dashboards or Home Assistant instances polling at once would. The run reports
+throughput, errors and latency percentiles, overall and per path.
+
+    python3 tools/http_bench.py 192.168.1.50
+    python3 tools/http_bench.py repel-0123456789abcdef.local --clients 6 --duration 30
+    python3 tools/http_bench.py 192.168.1.50 --path /api/events --path /api/bus/1/status --close
+
+Use --post to mix in a write (e.g. --post /api/bus/0/brightness value=128), which is answered as soon as the
+command is queued. Run it once with the repellers off and once while a bus is powering up or running to see
+whether bus activity holds requests up. Only the Python standard library is needed.
+"""
+
+import argparse
+import http.client
+import statistics
+import sys
+import threading
+import time
+
+DEFAULT_PATHS = ["/api/system/status", "/api/bus/0/status", "/api/bus/1/status"]
+
+
+class Results:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = {}  # Path -> seconds of each successful request
+        self.errors = {}     # Description -> count
+
+    def add(self, path, seconds):
+        with self.lock:
+            self.latencies.setdefault(path, []).append(seconds)
+
+    def fail(self, description):
+        with self.lock:
+            self.errors[description] = self.errors.get(description, 0) + 1
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(fraction * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def client(args, requests, stop_at, results):
+    connection = None
+    index = 0
+    while time.monotonic() < stop_at:
+        method, path, body = requests[index % len(requests)]
+        index += 1
+        if connection is None:
+            connection = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+
+        headers = {"Connection": "close"} if args.close else {}
+        if body is not None:
+            headers["Content-Type"] = "application/x-www-form-urlencoded"
+        start = time.monotonic()
+        try:
+            connection.request(method, path, body=body, headers=headers)
+            response = connection.getresponse()
+            response.read()
+            elapsed = time.monotonic() - start
+            if response.status >= 400:
+                results.fail("HTTP %d %s %s" % (response.status, method, path))
+            else:
+                results.add(method + " " + path, elapsed)
+            if args.close or response.will_close:
+                connection.close()
+                connection = None
+        except (OSError, http.client.HTTPException) as error:
+            results.fail(type(error).__name__)
+            connection.close()
+            connection = None
+            time.sleep(0.1)  # Don't spin if the device has stopped answering
+
+        if args.interval > 0:
+            time.sleep(args.interval)
+
+    if connection is not None:
+        connection.close()
+
+
+def report(results, elapsed):
+    all_latencies = [value for values in results.latencies.values() for value in values]
+    failed = sum(results.errors.values())
+    print("%d requests in %.1f s (%.1f/s), %d failed" % (len(all_latencies) + failed, elapsed,
+                                                         len(all_latencies) / elapsed, failed))
+    rows = [("all", all_latencies)] + sorted(results.latencies.items())
+    print("%-40s %7s %8s %8s %8s %8s" % ("", "count", "p50 ms", "p90 ms", "p99 ms", "max ms"))
+    for name, values in rows:
+        if not values:
+            continue
+        print("%-40s %7d %8.1f %8.1f %8.1f %8.1f" % (name, len(values), statistics.median(values) * 1000,
+                                                      percentile(values, 0.90) * 1000,
+                                                      percentile(values, 0.99) * 1000, max(values) * 1000))
+    for description, count in sorted(results.errors.items()):
+        print("  %s: %d" % (description, count))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Concurrent-client benchmark for the RepelBridge REST API")
+    parser.add_argument("host", help="device IP address or mDNS name")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--clients", type=int, default=4, help="concurrent connections (default 4)")
+    parser.add_argument("--duration", type=float, default=10, help="seconds to run (default 10)")
+    parser.add_argument("--path", action="append", help="GET this path (repeatable; default: the status endpoints)")
+    parser.add_argument("--post", nargs=2, action="append", metavar=("PATH", "FORM"),
+                        help="also POST this form body to PATH (repeatable)")
+    parser.add_argument("--interval", type=float, default=0, help="seconds each client waits between requests")
+    parser.add_argument("--timeout", type=float, default=10, help="seconds before a request counts as failed")
+    parser.add_argument("--close", action="store_true", help="open a new connection for every request")
+    args = parser.parse_args()
+
+    requests = [("GET", path, None) for path in (args.path or DEFAULT_PATHS)]
+    requests += [("POST", path, form) for path, form in (args.post or [])]
+
+    results = Results()
+    start = time.monotonic()
+    stop_at = start + args.duration
+    threads = []
+    for number in range(args.clients):
+        # Start each client at a different point in the list so the paths are requested concurrently
+        rotated = requests[number % len(requests):] + requests[:number % len(requests)]
+        thread = threading.Thread(target=client, args=(args, rotated, stop_at, results), daemon=True)
+        thread.start()
+        threads.append(thread)
+    for thread in threads:
+        thread.join()
+
+    report(results, time.monotonic() - start)
+    return 1 if not results.latencies else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())